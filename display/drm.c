@@ -22,20 +22,127 @@
 #include <errno.h>
 #include <sys/mman.h>
 #include <inttypes.h>
+#include <poll.h>
 
 #include <xf86drm.h>
 #include <xf86drmMode.h>
 #include <drm_fourcc.h>
 
+#include "pixconv.h"
+
 #define DBG_TAG "drm"
 
 #define DIV_ROUND_UP(n, d) (((n) + (d) - 1) / (d))
 
+#ifndef DRM_BUFFER_COUNT
+#define DRM_BUFFER_COUNT 2
+#endif
+
+#if DRM_BUFFER_COUNT < 2 || DRM_BUFFER_COUNT > 4
+#error DRM_BUFFER_COUNT must be between 2 and 4
+#endif
+
+/* Log the frame statistics every that many seconds, 0 to disable */
+#ifndef DRM_STATS_LOG_PERIOD
+#define DRM_STATS_LOG_PERIOD 0
+#endif
+
+/* Render at NUM/DEN of the mode size and let the plane scale up */
+#ifndef DRM_RENDER_SCALE_NUM
+#define DRM_RENDER_SCALE_NUM 1
+#endif
+
+#ifndef DRM_RENDER_SCALE_DEN
+#define DRM_RENDER_SCALE_DEN 1
+#endif
+
+#ifndef DRM_ROTATION
+#define DRM_ROTATION DRM_MODE_ROTATE_0
+#endif
+
+#define DRM_ROTATION_SWAPS_AXES (DRM_ROTATION & (DRM_MODE_ROTATE_90 | DRM_MODE_ROTATE_270))
+
+/* Tile edge of the software rotation, so reads and writes of a tile stay in the cache */
+#define DRM_ROTATE_TILE 32
+
+#ifndef DRM_RENDER_MARGIN_US
+#define DRM_RENDER_MARGIN_US 1000
+#endif
+
+/* Give up on async flips after this many refusals in a row */
+#define DRM_ASYNC_MAX_REFUSED 8
+
+/* Frames of damage remembered to bring an older buffer up to date */
+#define DRM_DAMAGE_HISTORY 8
+/* Rectangles per frame, more are merged into the last one */
+#define DRM_DAMAGE_RECTS 16
+
+/* Plane formats for LV_COLOR_DEPTH, cheapest conversion first */
+static const struct {
+	uint32_t fourcc;
+	uint32_t bpp;
+} drm_formats[] = {
+#if LV_COLOR_DEPTH == 32
+	{ DRM_FORMAT_XRGB8888, 32 },
+	{ DRM_FORMAT_ARGB8888, 32 },
+	{ DRM_FORMAT_XBGR8888, 32 },
+	{ DRM_FORMAT_ABGR8888, 32 },
+	{ DRM_FORMAT_RGB888, 24 },
+	{ DRM_FORMAT_BGR888, 24 },
+	{ DRM_FORMAT_RGB565, 16 },
+	{ DRM_FORMAT_BGR565, 16 },
+	{ DRM_FORMAT_RGB332, 8 },
+#elif LV_COLOR_DEPTH == 16
+	{ DRM_FORMAT_RGB565, 16 },
+	{ DRM_FORMAT_BGR565, 16 },
+	{ DRM_FORMAT_XRGB8888, 32 },
+	{ DRM_FORMAT_ARGB8888, 32 },
+	{ DRM_FORMAT_XBGR8888, 32 },
+	{ DRM_FORMAT_ABGR8888, 32 },
+	{ DRM_FORMAT_RGB888, 24 },
+	{ DRM_FORMAT_BGR888, 24 },
+	{ DRM_FORMAT_RGB332, 8 },
+#else
+	{ DRM_FORMAT_RGB332, 8 },
+	{ DRM_FORMAT_RGB565, 16 },
+	{ DRM_FORMAT_BGR565, 16 },
+	{ DRM_FORMAT_XRGB8888, 32 },
+	{ DRM_FORMAT_ARGB8888, 32 },
+	{ DRM_FORMAT_XBGR8888, 32 },
+	{ DRM_FORMAT_ABGR8888, 32 },
+	{ DRM_FORMAT_RGB888, 24 },
+	{ DRM_FORMAT_BGR888, 24 },
+#endif
+};
+
+/* The plane format has LVGL's pixel layout */
+#if LV_COLOR_DEPTH == 32
+#define DRM_FORMAT_IS_NATIVE(f) ((f) == DRM_FORMAT_XRGB8888 || (f) == DRM_FORMAT_ARGB8888)
+#elif LV_COLOR_DEPTH == 16 && !LV_COLOR_16_SWAP
+#define DRM_FORMAT_IS_NATIVE(f) ((f) == DRM_FORMAT_RGB565)
+#elif LV_COLOR_DEPTH == 8
+#define DRM_FORMAT_IS_NATIVE(f) ((f) == DRM_FORMAT_RGB332)
+#else
+#define DRM_FORMAT_IS_NATIVE(f) 0
+#endif
+
 #define print(msg, ...)	fprintf(stderr, msg, ##__VA_ARGS__);
 #define err(msg, ...)  print("error: " msg "\n", ##__VA_ARGS__)
 #define info(msg, ...) print(msg "\n", ##__VA_ARGS__)
 #define dbg(msg, ...)  {} //print(DBG_TAG ": " msg "\n", ##__VA_ARGS__)
 
+enum drm_buffer_state {
+	DRM_BUFFER_FREE,	/* can be drawn into */
+	DRM_BUFFER_DRAWING,	/* back buffer of the frame being drawn */
+	DRM_BUFFER_QUEUED,	/* finished, waiting to be committed or flipped */
+	DRM_BUFFER_ON_SCREEN,	/* scanned out */
+};
+
+struct drm_damage {
+	uint32_t count;
+	lv_area_t rects[DRM_DAMAGE_RECTS];
+};
+
 struct drm_buffer {
 	uint32_t handle;
 	uint32_t pitch;
@@ -43,18 +150,140 @@ struct drm_buffer {
 	unsigned long int size;
 	void * map;
 	uint32_t fb_handle;
+	uint32_t seq; /* last frame drawn into this buffer */
+	enum drm_buffer_state state;
+	uint64_t start_us; /* when LVGL started to flush its frame */
+	struct drm_damage damage; /* changes since the frame committed before, set under the lock */
+};
+
+/* Objects the driver sets properties on */
+enum drm_obj {
+	DRM_OBJ_CONN,
+	DRM_OBJ_CRTC,
+	DRM_OBJ_PRIMARY,
+	DRM_OBJ_CURSOR,
+	DRM_OBJ_OVERLAY,
+};
+
+/* Atomic properties set by the driver, each plane uses the same order */
+enum {
+	DRM_PROP_CONN_CRTC_ID,
+	DRM_PROP_CRTC_MODE_ID,
+	DRM_PROP_CRTC_ACTIVE,
+	DRM_PROP_FB_ID,
+	DRM_PROP_CRTC_ID,
+	DRM_PROP_SRC_X,
+	DRM_PROP_SRC_Y,
+	DRM_PROP_SRC_W,
+	DRM_PROP_SRC_H,
+	DRM_PROP_CRTC_X,
+	DRM_PROP_CRTC_Y,
+	DRM_PROP_CRTC_W,
+	DRM_PROP_CRTC_H,
+	DRM_PROP_CURSOR_FB_ID,
+	DRM_PROP_CURSOR_CRTC_ID,
+	DRM_PROP_CURSOR_SRC_X,
+	DRM_PROP_CURSOR_SRC_Y,
+	DRM_PROP_CURSOR_SRC_W,
+	DRM_PROP_CURSOR_SRC_H,
+	DRM_PROP_CURSOR_CRTC_X,
+	DRM_PROP_CURSOR_CRTC_Y,
+	DRM_PROP_CURSOR_CRTC_W,
+	DRM_PROP_CURSOR_CRTC_H,
+	DRM_PROP_OVERLAY_FB_ID,
+	DRM_PROP_OVERLAY_CRTC_ID,
+	DRM_PROP_OVERLAY_SRC_X,
+	DRM_PROP_OVERLAY_SRC_Y,
+	DRM_PROP_OVERLAY_SRC_W,
+	DRM_PROP_OVERLAY_SRC_H,
+	DRM_PROP_OVERLAY_CRTC_X,
+	DRM_PROP_OVERLAY_CRTC_Y,
+	DRM_PROP_OVERLAY_CRTC_W,
+	DRM_PROP_OVERLAY_CRTC_H,
+	/* Optional ones, 0 prop_id if missing */
+	DRM_PROP_FB_DAMAGE_CLIPS,
+	DRM_PROP_GAMMA_LUT,
+	DRM_PROP_CTM,
+	DRM_PROP_ROTATION,
+	DRM_PROP_COUNT
+};
+
+#define DRM_PROP_FIRST_OPTIONAL DRM_PROP_FB_DAMAGE_CLIPS
+
+static const struct {
+	enum drm_obj obj;
+	const char *name;
+} drm_prop_desc[DRM_PROP_COUNT] = {
+	[DRM_PROP_CONN_CRTC_ID]    = { DRM_OBJ_CONN, "CRTC_ID" },
+	[DRM_PROP_CRTC_MODE_ID]    = { DRM_OBJ_CRTC, "MODE_ID" },
+	[DRM_PROP_CRTC_ACTIVE]     = { DRM_OBJ_CRTC, "ACTIVE" },
+	[DRM_PROP_FB_ID]           = { DRM_OBJ_PRIMARY, "FB_ID" },
+	[DRM_PROP_CRTC_ID]         = { DRM_OBJ_PRIMARY, "CRTC_ID" },
+	[DRM_PROP_SRC_X]           = { DRM_OBJ_PRIMARY, "SRC_X" },
+	[DRM_PROP_SRC_Y]           = { DRM_OBJ_PRIMARY, "SRC_Y" },
+	[DRM_PROP_SRC_W]           = { DRM_OBJ_PRIMARY, "SRC_W" },
+	[DRM_PROP_SRC_H]           = { DRM_OBJ_PRIMARY, "SRC_H" },
+	[DRM_PROP_CRTC_X]          = { DRM_OBJ_PRIMARY, "CRTC_X" },
+	[DRM_PROP_CRTC_Y]          = { DRM_OBJ_PRIMARY, "CRTC_Y" },
+	[DRM_PROP_CRTC_W]          = { DRM_OBJ_PRIMARY, "CRTC_W" },
+	[DRM_PROP_CRTC_H]          = { DRM_OBJ_PRIMARY, "CRTC_H" },
+	[DRM_PROP_CURSOR_FB_ID]    = { DRM_OBJ_CURSOR, "FB_ID" },
+	[DRM_PROP_CURSOR_CRTC_ID]  = { DRM_OBJ_CURSOR, "CRTC_ID" },
+	[DRM_PROP_CURSOR_SRC_X]    = { DRM_OBJ_CURSOR, "SRC_X" },
+	[DRM_PROP_CURSOR_SRC_Y]    = { DRM_OBJ_CURSOR, "SRC_Y" },
+	[DRM_PROP_CURSOR_SRC_W]    = { DRM_OBJ_CURSOR, "SRC_W" },
+	[DRM_PROP_CURSOR_SRC_H]    = { DRM_OBJ_CURSOR, "SRC_H" },
+	[DRM_PROP_CURSOR_CRTC_X]   = { DRM_OBJ_CURSOR, "CRTC_X" },
+	[DRM_PROP_CURSOR_CRTC_Y]   = { DRM_OBJ_CURSOR, "CRTC_Y" },
+	[DRM_PROP_CURSOR_CRTC_W]   = { DRM_OBJ_CURSOR, "CRTC_W" },
+	[DRM_PROP_CURSOR_CRTC_H]   = { DRM_OBJ_CURSOR, "CRTC_H" },
+	[DRM_PROP_OVERLAY_FB_ID]   = { DRM_OBJ_OVERLAY, "FB_ID" },
+	[DRM_PROP_OVERLAY_CRTC_ID] = { DRM_OBJ_OVERLAY, "CRTC_ID" },
+	[DRM_PROP_OVERLAY_SRC_X]   = { DRM_OBJ_OVERLAY, "SRC_X" },
+	[DRM_PROP_OVERLAY_SRC_Y]   = { DRM_OBJ_OVERLAY, "SRC_Y" },
+	[DRM_PROP_OVERLAY_SRC_W]   = { DRM_OBJ_OVERLAY, "SRC_W" },
+	[DRM_PROP_OVERLAY_SRC_H]   = { DRM_OBJ_OVERLAY, "SRC_H" },
+	[DRM_PROP_OVERLAY_CRTC_X]  = { DRM_OBJ_OVERLAY, "CRTC_X" },
+	[DRM_PROP_OVERLAY_CRTC_Y]  = { DRM_OBJ_OVERLAY, "CRTC_Y" },
+	[DRM_PROP_OVERLAY_CRTC_W]  = { DRM_OBJ_OVERLAY, "CRTC_W" },
+	[DRM_PROP_OVERLAY_CRTC_H]  = { DRM_OBJ_OVERLAY, "CRTC_H" },
+	[DRM_PROP_FB_DAMAGE_CLIPS] = { DRM_OBJ_PRIMARY, "FB_DAMAGE_CLIPS" },
+	[DRM_PROP_GAMMA_LUT]       = { DRM_OBJ_CRTC, "GAMMA_LUT" },
+	[DRM_PROP_CTM]             = { DRM_OBJ_CRTC, "CTM" },
+	[DRM_PROP_ROTATION]        = { DRM_OBJ_PRIMARY, "rotation" },
+};
+
+struct drm_prop {
+	uint32_t obj_id;
+	uint32_t prop_id;
+	uint64_t value; /* last value added to a commit */
+	int known; /* the kernel has value */
+};
+
+/* Cursor plane state, committed along with the next frame or on its own */
+struct drm_cursor {
+	uint32_t fb; /* 0 while hidden */
+	int32_t x, y; /* top left corner on the CRTC */
 };
 
 struct drm_dev {
 	int fd;
 	uint32_t conn_id, enc_id, crtc_id, plane_id, crtc_idx;
-	uint32_t width, height;
+	uint32_t cursor_plane_id, overlay_plane_id; /* 0 if there is none */
+	uint32_t width, height; /* mode size */
+	uint32_t fb_width, fb_height; /* buffer size */
+	uint32_t lv_width, lv_height; /* LVGL's resolution, the buffer size unless rotated in software */
+	uint64_t rotations; /* DRM_MODE_ROTATE/REFLECT bits the plane offers */
+	uint32_t plane_rotation; /* DRM_ROTATION if the plane does it, else DRM_MODE_ROTATE_0 */
+	uint32_t sw_rotation; /* DRM_ROTATION if drm_flush() does it, else DRM_MODE_ROTATE_0 */
 	uint32_t mmWidth, mmHeight;
 	uint32_t fourcc;
+	uint32_t bpp, cpp; /* bits and bytes per pixel of fourcc */
 	drmModeModeInfo mode;
 	uint32_t blob_id;
 	drmModeCrtc *saved_crtc;
-	drmModeAtomicReq *req;
+	drmModeAtomicReq *req; /* reused for every commit */
+	struct drm_prop props[DRM_PROP_COUNT];
 	drmEventContext drm_event_ctx;
 	drmModePlane *plane;
 	drmModeCrtc *crtc;
@@ -65,8 +294,48 @@ struct drm_dev {
 	drmModePropertyPtr plane_props[128];
 	drmModePropertyPtr crtc_props[128];
 	drmModePropertyPtr conn_props[128];
-	struct drm_buffer drm_bufs[2]; /* DUMB buffers */
-	struct drm_buffer *cur_bufs[2]; /* double buffering handling */
+	struct drm_buffer drm_bufs[DRM_BUFFER_COUNT]; /* DUMB buffers (swapchain) */
+	struct drm_buffer *back; /* buffer of the frame being drawn, NULL between frames */
+	int direct; /* LVGL draws straight into drm_bufs[0] and [1] */
+	uint8_t *shadow; /* cached copy of the latest frame, same layout as the buffers */
+	uint32_t frame_seq; /* last frame drawn */
+	struct drm_damage damage[DRM_DAMAGE_HISTORY]; /* damage of the last frames by frame_seq, LVGL thread only */
+	pthread_t present_thread; /* commits frames and handles the DRM events */
+	pthread_mutex_t lock; /* protects the buffer states and the fields below */
+	pthread_cond_t cond; /* signalled when any of them changes */
+	struct drm_buffer *queue[DRM_BUFFER_COUNT]; /* finished frames in order */
+	uint32_t queue_len;
+	struct drm_buffer *pending; /* frame committed, flip not done yet */
+	struct drm_buffer *front; /* buffer on screen */
+	lv_disp_drv_t *ready_drv; /* released once a back buffer is free again */
+	int flip_pending; /* a commit waits for its page flip event */
+	struct drm_damage lost_damage; /* of frames whose commit failed, added to the next one */
+	drm_present_mode_t present_mode;
+	int async_cap; /* the driver takes atomic async flips */
+	int async_refused; /* async flips refused in a row */
+	uint64_t vblank_us; /* last flip event, 0 before the first */
+	uint64_t render_start_us; /* when the main loop was told to render */
+	uint32_t render_us; /* estimated time to render and flush a frame */
+	drm_stats_t stats;
+	uint64_t latency_sum_us;
+	uint64_t frame_time_sum_us;
+	uint64_t last_flip_us; /* vblank of the last frame shown, 0 before the first */
+	uint32_t last_flip_seq;
+	uint64_t last_log_us;
+	struct drm_buffer cursor_buf;
+	uint32_t cursor_w, cursor_h;
+	int32_t cursor_pos_x, cursor_pos_y; /* pointer position on the CRTC */
+	int32_t cursor_hot_x, cursor_hot_y;
+	struct drm_cursor cursor;
+	int cursor_dirty; /* cursor changed since the last commit */
+	struct drm_buffer ovl_bufs[2]; /* LVGL's double buffers of the overlay display */
+	struct drm_buffer *ovl_queued, *ovl_pending;
+	lv_disp_drv_t *ovl_drv;
+	uint64_t gamma_size; /* entries of the GAMMA_LUT */
+	uint32_t color_next; /* GAMMA_LUT or CTM blob waiting for a commit */
+	uint32_t color_cur; /* the blob last committed, 0: no modulation */
+	int color_dirty;
+	int quit;
 } drm_dev;
 
 static uint32_t get_plane_property_id(const char *name)
@@ -114,10 +383,157 @@ static uint32_t get_conn_property_id(const char *name)
 	return 0;
 }
 
+static uint64_t drm_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void drm_stats_log(void)
+{
+	drm_stats_t *st = &drm_dev.stats;
+	char hist[DRM_STATS_HIST_SIZE * 11 + 1];
+	int i, len = 0;
+
+	for (i = 0; i < DRM_STATS_HIST_SIZE; i++)
+		len += snprintf(hist + len, sizeof(hist) - len, " %u", st->frame_time_hist[i]);
+
+	info("drm: %u frames, %u missed vblanks, %u dropped, frame time avg %u max %u us, "
+	     "latency avg %u max %u us, histogram (vblanks):%s",
+	     st->frames, st->missed_vblanks, st->dropped_frames, st->frame_time_avg_us, st->frame_time_max_us,
+	     st->latency_avg_us, st->latency_max_us, hist);
+}
+
+/* Refresh period of the mode */
+static uint32_t drm_frame_period_us(void)
+{
+	if (drm_dev.mode.clock && drm_dev.mode.htotal && drm_dev.mode.vtotal)
+		return (uint64_t)drm_dev.mode.htotal * drm_dev.mode.vtotal * 1000 / drm_dev.mode.clock;
+
+	return 1000000 / (drm_dev.mode.vrefresh ? drm_dev.mode.vrefresh : 60);
+}
+
+/*
+ * Account a frame that reached the screen at vblank seq/now_us. A vblank is
+ * missed if it repeated the previous frame although LVGL had already started
+ * this one, so idle time doesn't count. Frame times only count while LVGL
+ * renders continuously, i.e. it started the frame before the first vblank
+ * after the previous one. Called with drm_dev.lock held.
+ */
+static void drm_stats_frame(const struct drm_buffer *buf, uint32_t seq, uint64_t now_us)
+{
+	drm_stats_t *st = &drm_dev.stats;
+	uint32_t latency = now_us > buf->start_us ? now_us - buf->start_us : 0;
+	uint32_t period = drm_frame_period_us();
+	uint32_t vblanks, start_seq, frame_time;
+
+	st->frames++;
+	st->last_sequence = seq;
+	st->last_vblank_us = now_us;
+
+	drm_dev.latency_sum_us += latency;
+	st->latency_avg_us = drm_dev.latency_sum_us / st->frames;
+	if (latency > st->latency_max_us)
+		st->latency_max_us = latency;
+
+	if (drm_dev.last_flip_us) {
+		vblanks = seq - drm_dev.last_flip_seq;
+
+		/* Vblank counter when the frame was started */
+		start_seq = drm_dev.last_flip_seq;
+		if (buf->start_us > drm_dev.last_flip_us)
+			start_seq += (buf->start_us - drm_dev.last_flip_us) / period;
+
+		if (seq - start_seq > 1 && seq - start_seq <= vblanks)
+			st->missed_vblanks += seq - start_seq - 1;
+
+		if (start_seq == drm_dev.last_flip_seq && vblanks >= 1) {
+			frame_time = now_us - drm_dev.last_flip_us;
+
+			st->frame_time_hist[LV_MATH_MIN(vblanks, DRM_STATS_HIST_SIZE) - 1]++;
+			st->continuous_frames++;
+			drm_dev.frame_time_sum_us += frame_time;
+			st->frame_time_avg_us = drm_dev.frame_time_sum_us / st->continuous_frames;
+			if (frame_time > st->frame_time_max_us)
+				st->frame_time_max_us = frame_time;
+		}
+	}
+
+	drm_dev.last_flip_us = now_us;
+	drm_dev.last_flip_seq = seq;
+
+#if DRM_STATS_LOG_PERIOD
+	if (now_us - drm_dev.last_log_us >= DRM_STATS_LOG_PERIOD * 1000000ULL) {
+		if (drm_dev.last_log_us)
+			drm_stats_log();
+		drm_dev.last_log_us = now_us;
+	}
+#endif
+}
+
+/*
+ * Free buffer with the most recent content (least to catch up), NULL if the
+ * whole swapchain is queued or on screen. Called with drm_dev.lock held.
+ */
+static struct drm_buffer *drm_buffer_find_free(void)
+{
+	struct drm_buffer *best = NULL;
+	int i;
+
+	for (i = 0; i < DRM_BUFFER_COUNT; i++) {
+		struct drm_buffer *buf = &drm_dev.drm_bufs[i];
+
+		if (buf->state != DRM_BUFFER_FREE)
+			continue;
+		if (!best || (int32_t)(buf->seq - best->seq) > 0)
+			best = buf;
+	}
+
+	return best;
+}
+
+/* Called with drm_dev.lock held whenever a buffer may have become free */
+static void drm_present_release(void)
+{
+	if (drm_dev.ready_drv && drm_buffer_find_free()) {
+		lv_disp_flush_ready(drm_dev.ready_drv);
+		drm_dev.ready_drv = NULL;
+	}
+
+	pthread_cond_broadcast(&drm_dev.cond);
+}
+
 static void page_flip_handler(int fd, unsigned int sequence, unsigned int tv_sec,
 			      unsigned int tv_usec, void *user_data)
 {
 	dbg("flip");
+
+	pthread_mutex_lock(&drm_dev.lock);
+
+	drm_dev.vblank_us = (uint64_t)tv_sec * 1000000 + tv_usec;
+
+	/* The previous front buffer left the screen */
+	if (drm_dev.pending) {
+		drm_stats_frame(drm_dev.pending, sequence, (uint64_t)tv_sec * 1000000 + tv_usec);
+
+		if (drm_dev.front)
+			drm_dev.front->state = DRM_BUFFER_FREE;
+		drm_dev.front = drm_dev.pending;
+		drm_dev.front->state = DRM_BUFFER_ON_SCREEN;
+		drm_dev.pending = NULL;
+	}
+
+	/* So did the previous overlay buffer, LVGL can draw the next one */
+	if (drm_dev.ovl_pending) {
+		drm_dev.ovl_pending = NULL;
+		lv_disp_flush_ready(drm_dev.ovl_drv);
+	}
+
+	drm_dev.flip_pending = 0;
+	drm_present_release();
+	pthread_mutex_unlock(&drm_dev.lock);
 }
 
 static int drm_get_plane_props(void)
@@ -183,112 +599,411 @@ static int drm_get_conn_props(void)
 	return 0;
 }
 
-static int drm_add_plane_property(const char *name, uint64_t value)
+/* Look up a property of any object, for objects without cached props */
+static uint32_t drm_get_object_prop(uint32_t obj_id, uint32_t obj_type, const char *name,
+				    uint64_t *value)
 {
-	int ret;
-	uint32_t prop_id = get_plane_property_id(name);
+	drmModeObjectPropertiesPtr props;
+	drmModePropertyPtr prop;
+	uint32_t i, prop_id = 0;
 
-	if (!prop_id) {
-		err("Couldn't find plane prop %s", name);
-		return -1;
+	props = drmModeObjectGetProperties(drm_dev.fd, obj_id, obj_type);
+	if (!props)
+		return 0;
+
+	for (i = 0; i < props->count_props && !prop_id; i++) {
+		prop = drmModeGetProperty(drm_dev.fd, props->props[i]);
+		if (!prop)
+			continue;
+		if (!strcmp(prop->name, name)) {
+			prop_id = prop->prop_id;
+			if (value)
+				*value = props->prop_values[i];
+		}
+		drmModeFreeProperty(prop);
 	}
 
-	ret = drmModeAtomicAddProperty(drm_dev.req, drm_dev.plane_id, get_plane_property_id(name), value);
-	if (ret < 0) {
-		err("drmModeAtomicAddProperty (%s:%" PRIu64 ") failed: %d", name, value, ret);
-		return ret;
+	drmModeFreeObjectProperties(props);
+
+	return prop_id;
+}
+
+/*
+ * Look up the IDs of drm_prop_desc once. The cursor and overlay planes are
+ * optional and left unused if one of their properties is missing, so are the
+ * properties from DRM_PROP_FIRST_OPTIONAL.
+ */
+static int drm_resolve_props(void)
+{
+	uint32_t i;
+
+	for (i = 0; i < DRM_PROP_COUNT; i++) {
+		struct drm_prop *prop = &drm_dev.props[i];
+		const char *name = drm_prop_desc[i].name;
+
+		prop->known = 0;
+
+		switch (drm_prop_desc[i].obj) {
+		case DRM_OBJ_CONN:
+			prop->obj_id = drm_dev.conn_id;
+			prop->prop_id = get_conn_property_id(name);
+			break;
+		case DRM_OBJ_CRTC:
+			prop->obj_id = drm_dev.crtc_id;
+			prop->prop_id = get_crtc_property_id(name);
+			break;
+		case DRM_OBJ_PRIMARY:
+			prop->obj_id = drm_dev.plane_id;
+			prop->prop_id = get_plane_property_id(name);
+			break;
+		case DRM_OBJ_CURSOR:
+			prop->obj_id = drm_dev.cursor_plane_id;
+			prop->prop_id = prop->obj_id ? drm_get_object_prop(prop->obj_id,
+						DRM_MODE_OBJECT_PLANE, name, NULL) : 0;
+			if (prop->obj_id && !prop->prop_id) {
+				info("drm: cursor plane lacks %s, not using it", name);
+				drm_dev.cursor_plane_id = 0;
+			}
+			continue;
+		case DRM_OBJ_OVERLAY:
+			prop->obj_id = drm_dev.overlay_plane_id;
+			prop->prop_id = prop->obj_id ? drm_get_object_prop(prop->obj_id,
+						DRM_MODE_OBJECT_PLANE, name, NULL) : 0;
+			if (prop->obj_id && !prop->prop_id) {
+				info("drm: overlay plane lacks %s, not using it", name);
+				drm_dev.overlay_plane_id = 0;
+			}
+			continue;
+		}
+
+		if (!prop->prop_id && i < DRM_PROP_FIRST_OPTIONAL) {
+			err("Couldn't find prop %s", name);
+			return -1;
+		}
 	}
 
 	return 0;
 }
 
-static int drm_add_crtc_property(const char *name, uint64_t value)
+/* Add a property to drm_dev.req unless the kernel already has that value */
+static int drm_set_prop(int idx, uint64_t value)
 {
+	struct drm_prop *prop = &drm_dev.props[idx];
 	int ret;
-	uint32_t prop_id = get_crtc_property_id(name);
 
-	if (!prop_id) {
-		err("Couldn't find crtc prop %s", name);
-		return -1;
-	}
+	if (prop->known && prop->value == value)
+		return 0;
 
-	ret = drmModeAtomicAddProperty(drm_dev.req, drm_dev.crtc_id, get_crtc_property_id(name), value);
+	ret = drmModeAtomicAddProperty(drm_dev.req, prop->obj_id, prop->prop_id, value);
 	if (ret < 0) {
-		err("drmModeAtomicAddProperty (%s:%" PRIu64 ") failed: %d", name, value, ret);
+		err("drmModeAtomicAddProperty (%s:%" PRIu64 ") failed: %d",
+		    drm_prop_desc[idx].name, value, ret);
 		return ret;
 	}
 
+	prop->value = value;
+	prop->known = 1;
+
 	return 0;
 }
 
-static int drm_add_conn_property(const char *name, uint64_t value)
+/* After a failed commit nothing is known about the kernel state */
+static void drm_forget_props(void)
 {
-	int ret;
-	uint32_t prop_id = get_conn_property_id(name);
+	uint32_t i;
 
-	if (!prop_id) {
-		err("Couldn't find conn prop %s", name);
-		return -1;
+	for (i = 0; i < DRM_PROP_COUNT; i++)
+		drm_dev.props[i].known = 0;
+}
+
+/* Property of the plane whose FB_ID is base, as the primary plane's prop */
+#define DRM_PLANE_PROP(base, prop) ((base) + (prop) - DRM_PROP_FB_ID)
+
+/*
+ * Show fb on a plane, base being its DRM_PROP_*FB_ID. The source is the whole
+ * fb, an fb of 0 disables the plane.
+ */
+static void drm_set_plane(int base, uint32_t fb, uint32_t src_w, uint32_t src_h,
+			  int32_t crtc_x, int32_t crtc_y, uint32_t crtc_w, uint32_t crtc_h)
+{
+	drm_set_prop(DRM_PLANE_PROP(base, DRM_PROP_FB_ID), fb);
+	drm_set_prop(DRM_PLANE_PROP(base, DRM_PROP_CRTC_ID), fb ? drm_dev.crtc_id : 0);
+	if (!fb)
+		return;
+
+	drm_set_prop(DRM_PLANE_PROP(base, DRM_PROP_SRC_X), 0);
+	drm_set_prop(DRM_PLANE_PROP(base, DRM_PROP_SRC_Y), 0);
+	drm_set_prop(DRM_PLANE_PROP(base, DRM_PROP_SRC_W), (uint64_t)src_w << 16);
+	drm_set_prop(DRM_PLANE_PROP(base, DRM_PROP_SRC_H), (uint64_t)src_h << 16);
+	drm_set_prop(DRM_PLANE_PROP(base, DRM_PROP_CRTC_X), (uint64_t)(int64_t)crtc_x);
+	drm_set_prop(DRM_PLANE_PROP(base, DRM_PROP_CRTC_Y), (uint64_t)(int64_t)crtc_y);
+	drm_set_prop(DRM_PLANE_PROP(base, DRM_PROP_CRTC_W), crtc_w);
+	drm_set_prop(DRM_PLANE_PROP(base, DRM_PROP_CRTC_H), crtc_h);
+}
+
+static void drm_damage_add(struct drm_damage *d, const lv_area_t *area)
+{
+	lv_area_t *last;
+
+	if (d->count < DRM_DAMAGE_RECTS) {
+		d->rects[d->count++] = *area;
+		return;
 	}
 
-	ret = drmModeAtomicAddProperty(drm_dev.req, drm_dev.conn_id, get_conn_property_id(name), value);
-	if (ret < 0) {
-		err("drmModeAtomicAddProperty (%s:%" PRIu64 ") failed: %d", name, value, ret);
-		return ret;
+	/* Out of rectangles, grow the last one */
+	last = &d->rects[DRM_DAMAGE_RECTS - 1];
+	last->x1 = LV_MATH_MIN(last->x1, area->x1);
+	last->y1 = LV_MATH_MIN(last->y1, area->y1);
+	last->x2 = LV_MATH_MAX(last->x2, area->x2);
+	last->y2 = LV_MATH_MAX(last->y2, area->y2);
+}
+
+static void drm_damage_merge(struct drm_damage *d, const struct drm_damage *from)
+{
+	uint32_t i;
+
+	for (i = 0; i < from->count; i++)
+		drm_damage_add(d, &from->rects[i]);
+}
+
+/*
+ * Blob of what changed in buf since the frame last committed, as a hint for
+ * drivers that upload the image (USB, SPI, virtual GPUs). 0 means all of it.
+ */
+static uint32_t drm_damage_blob(const struct drm_buffer *buf)
+{
+	const struct drm_damage *d = &buf->damage;
+	struct drm_mode_rect rects[DRM_DAMAGE_RECTS];
+	uint32_t i, blob_id = 0;
+
+	/* Unknown in the zero-copy mode */
+	if (drm_dev.direct || !d->count)
+		return 0;
+
+	/* drm_mode_rect excludes x2 and y2 */
+	for (i = 0; i < d->count; i++) {
+		rects[i].x1 = d->rects[i].x1;
+		rects[i].y1 = d->rects[i].y1;
+		rects[i].x2 = d->rects[i].x2 + 1;
+		rects[i].y2 = d->rects[i].y2 + 1;
 	}
 
-	return 0;
+	if (drmModeCreatePropertyBlob(drm_dev.fd, rects, d->count * sizeof(rects[0]), &blob_id))
+		blob_id = 0;
+
+	return blob_id;
 }
 
-static int drm_dmabuf_set_plane(struct drm_buffer *buf)
+/*
+ * Commit a new primary buffer, overlay buffer and cursor state, each of them
+ * may be NULL to keep it as is.
+ */
+static int drm_dmabuf_set_plane(struct drm_buffer *buf, struct drm_buffer *ovl,
+				const struct drm_cursor *cursor, uint32_t color, uint32_t flags)
 {
+	uint32_t damage_blob = 0;
 	int ret;
-	static int first = 1;
-	uint32_t flags = DRM_MODE_PAGE_FLIP_EVENT;
 
-	drm_dev.req = drmModeAtomicAlloc();
+	drmModeAtomicSetCursor(drm_dev.req, 0);
 
-	/* On first Atomic commit, do a modeset */
-	if (first) {
-		drm_add_conn_property("CRTC_ID", drm_dev.crtc_id);
+	/*
+	 * Async flips may only change FB_ID: no damage, modeset, colour or
+	 * plane geometry. A refused one changed nothing, so only FB_ID has to
+	 * be taken back and the synced retry stays as small.
+	 */
+	if (flags & DRM_MODE_PAGE_FLIP_ASYNC) {
+		struct drm_prop fb_id = drm_dev.props[DRM_PROP_FB_ID];
+
+		drm_set_prop(DRM_PROP_FB_ID, buf->fb_handle);
+		ret = drmModeAtomicCommit(drm_dev.fd, drm_dev.req, flags, NULL);
+		if (ret)
+			drm_dev.props[DRM_PROP_FB_ID] = fb_id;
 
-		drm_add_crtc_property("MODE_ID", drm_dev.blob_id);
-		drm_add_crtc_property("ACTIVE", 1);
+		return ret;
+	}
 
+	/* On first Atomic commit, do a modeset */
+	if (!drm_dev.props[DRM_PROP_CRTC_ACTIVE].known)
 		flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
 
-		first = 0;
+	drm_set_prop(DRM_PROP_CONN_CRTC_ID, drm_dev.crtc_id);
+	drm_set_prop(DRM_PROP_CRTC_MODE_ID, drm_dev.blob_id);
+	drm_set_prop(DRM_PROP_CRTC_ACTIVE, 1);
+
+	if (drm_dev.props[DRM_PROP_ROTATION].prop_id)
+		drm_set_prop(DRM_PROP_ROTATION, drm_dev.plane_rotation);
+
+	/* Brightness and colour modulation, in the LUT or else in the matrix */
+	if (drm_dev.props[DRM_PROP_GAMMA_LUT].prop_id)
+		drm_set_prop(DRM_PROP_GAMMA_LUT, color);
+	else if (drm_dev.props[DRM_PROP_CTM].prop_id)
+		drm_set_prop(DRM_PROP_CTM, color);
+
+	/* Usually only FB_ID changes */
+	if (buf) {
+		drm_set_plane(DRM_PROP_FB_ID, buf->fb_handle, drm_dev.fb_width, drm_dev.fb_height,
+			      0, 0, drm_dev.width, drm_dev.height);
+
+		if (drm_dev.props[DRM_PROP_FB_DAMAGE_CLIPS].prop_id &&
+		    !(flags & DRM_MODE_ATOMIC_TEST_ONLY)) {
+			damage_blob = drm_damage_blob(buf);
+			drm_set_prop(DRM_PROP_FB_DAMAGE_CLIPS, damage_blob);
+		}
 	}
 
-	drm_add_plane_property("FB_ID", buf->fb_handle);
-	drm_add_plane_property("CRTC_ID", drm_dev.crtc_id);
-	drm_add_plane_property("SRC_X", 0);
-	drm_add_plane_property("SRC_Y", 0);
-	drm_add_plane_property("SRC_W", drm_dev.width << 16);
-	drm_add_plane_property("SRC_H", drm_dev.height << 16);
-	drm_add_plane_property("CRTC_X", 0);
-	drm_add_plane_property("CRTC_Y", 0);
-	drm_add_plane_property("CRTC_W", drm_dev.width);
-	drm_add_plane_property("CRTC_H", drm_dev.height);
+	if (ovl)
+		drm_set_plane(DRM_PROP_OVERLAY_FB_ID, ovl->fb_handle, drm_dev.fb_width, drm_dev.fb_height,
+			      0, 0, drm_dev.width, drm_dev.height);
+
+	if (cursor)
+		drm_set_plane(DRM_PROP_CURSOR_FB_ID, cursor->fb, drm_dev.cursor_w, drm_dev.cursor_h,
+			      cursor->x, cursor->y, drm_dev.cursor_w, drm_dev.cursor_h);
 
 	ret = drmModeAtomicCommit(drm_dev.fd, drm_dev.req, flags, NULL);
-	if (ret) {
+	if (ret && !(flags & DRM_MODE_ATOMIC_TEST_ONLY))
 		err("drmModeAtomicCommit failed: %s", strerror(errno));
-		drmModeAtomicFree(drm_dev.req);
-		return ret;
+
+	/* The kernel holds on to the damage of this commit only */
+	if (damage_blob) {
+		drmModeDestroyPropertyBlob(drm_dev.fd, damage_blob);
+		drm_dev.props[DRM_PROP_FB_DAMAGE_CLIPS].value = 0;
 	}
 
-	return 0;
+	/* A test commit changes nothing */
+	if (ret || (flags & DRM_MODE_ATOMIC_TEST_ONLY))
+		drm_forget_props();
+
+	return ret;
+}
+
+/*
+ * Presentation thread: owns the commits and the DRM events so the LVGL
+ * thread can render the next frame while the last one waits for vblank.
+ */
+static void *drm_present_thread(void *arg)
+{
+	struct pollfd pfd = { .fd = drm_dev.fd, .events = POLLIN };
+	struct drm_buffer *buf, *ovl;
+	struct drm_cursor cursor;
+	uint32_t flags, color;
+	int ret, update;
+
+	pthread_mutex_lock(&drm_dev.lock);
+
+	while (!drm_dev.quit) {
+		/* Cursor and overlay changes wait for the first frame */
+		update = drm_dev.queue_len ||
+			 (drm_dev.front && (drm_dev.cursor_dirty || drm_dev.ovl_queued || drm_dev.color_dirty));
+
+		/*
+		 * Once the previous flip is done, commit the oldest queued frame
+		 * together with the latest overlay and cursor
+		 */
+		if (update && !drm_dev.flip_pending) {
+			buf = NULL;
+			if (drm_dev.queue_len) {
+				buf = drm_dev.queue[0];
+				drm_dev.queue_len--;
+				memmove(&drm_dev.queue[0], &drm_dev.queue[1],
+					drm_dev.queue_len * sizeof(drm_dev.queue[0]));
+
+				/* Frames that never made it to the screen changed it too */
+				drm_damage_merge(&buf->damage, &drm_dev.lost_damage);
+				drm_dev.lost_damage.count = 0;
+			}
+			ovl = drm_dev.ovl_queued;
+			drm_dev.ovl_queued = NULL;
+			cursor = drm_dev.cursor;
+			color = drm_dev.color_dirty ? drm_dev.color_next : drm_dev.color_cur;
+			flags = DRM_MODE_PAGE_FLIP_EVENT | DRM_MODE_ATOMIC_NONBLOCK;
+			if (drm_dev.present_mode == DRM_PRESENT_ASYNC && buf && !ovl && !drm_dev.cursor_dirty &&
+			    !drm_dev.color_dirty && drm_dev.props[DRM_PROP_CRTC_ACTIVE].known)
+				flags |= DRM_MODE_PAGE_FLIP_ASYNC;
+			drm_dev.cursor_dirty = 0;
+			drm_dev.color_dirty = 0;
+			pthread_mutex_unlock(&drm_dev.lock);
+
+			ret = drm_dmabuf_set_plane(buf, ovl, drm_dev.cursor_plane_id ? &cursor : NULL,
+						   color, flags);
+
+			/* Async flips may only change FB_ID, have it synced then */
+			if (ret && (flags & DRM_MODE_PAGE_FLIP_ASYNC)) {
+				dbg("async flip refused, retrying synced");
+				ret = drm_dmabuf_set_plane(buf, ovl, drm_dev.cursor_plane_id ? &cursor : NULL,
+							   color, flags & ~DRM_MODE_PAGE_FLIP_ASYNC);
+				drm_dev.async_refused++;
+			} else if (flags & DRM_MODE_PAGE_FLIP_ASYNC) {
+				drm_dev.async_refused = 0;
+			}
+
+			/* Only the thread commits, so it retires the replaced blob */
+			if (color != drm_dev.color_cur) {
+				if (ret) {
+					drmModeDestroyPropertyBlob(drm_dev.fd, color);
+				} else {
+					if (drm_dev.color_cur)
+						drmModeDestroyPropertyBlob(drm_dev.fd, drm_dev.color_cur);
+					drm_dev.color_cur = color;
+				}
+			}
+
+			pthread_mutex_lock(&drm_dev.lock);
+			if (drm_dev.async_refused >= DRM_ASYNC_MAX_REFUSED &&
+			    drm_dev.present_mode == DRM_PRESENT_ASYNC) {
+				drm_dev.present_mode = DRM_BUFFER_COUNT < 4 ? DRM_PRESENT_FIFO : DRM_PRESENT_MAILBOX;
+				info("drm: async flips keep being refused, back to %s",
+				     drm_dev.present_mode == DRM_PRESENT_MAILBOX ? "mailbox" : "FIFO");
+			}
+			if (ret) {
+				err("Flush fail");
+				if (buf) {
+					drm_dev.lost_damage = buf->damage;
+					buf->state = DRM_BUFFER_FREE;
+				}
+				if (ovl)
+					lv_disp_flush_ready(drm_dev.ovl_drv);
+				drm_present_release();
+			} else {
+				dbg("Flush done");
+				drm_dev.pending = buf;
+				drm_dev.ovl_pending = ovl;
+				drm_dev.flip_pending = 1;
+			}
+			continue;
+		}
+
+		if (!drm_dev.flip_pending) {
+			pthread_cond_wait(&drm_dev.cond, &drm_dev.lock);
+			continue;
+		}
+
+		/* Wake up now and then to notice drm_exit() */
+		pthread_mutex_unlock(&drm_dev.lock);
+
+		ret = poll(&pfd, 1, 100);
+		if (ret > 0)
+			drmHandleEvent(drm_dev.fd, &drm_dev.drm_event_ctx);
+		else if (ret < 0 && errno != EINTR)
+			err("poll failed: %s", strerror(errno));
+
+		pthread_mutex_lock(&drm_dev.lock);
+	}
+
+	pthread_mutex_unlock(&drm_dev.lock);
+
+	return NULL;
 }
 
-static int find_plane(unsigned int fourcc, uint32_t *plane_id, uint32_t crtc_id, uint32_t crtc_idx)
+static int find_plane(unsigned int fourcc, uint32_t *plane_id, uint32_t crtc_id, uint32_t crtc_idx,
+		      uint64_t type)
 {
+	uint64_t plane_type;
 	drmModePlaneResPtr planes;
 	drmModePlanePtr plane;
 	unsigned int i;
 	unsigned int j;
 	int ret = 0;
-	unsigned int format = fourcc;
+	unsigned int format = fourcc; /* 0 for any */
 
 	planes = drmModeGetPlaneResources(drm_dev.fd);
 	if (!planes) {
@@ -310,8 +1025,14 @@ static int find_plane(unsigned int fourcc, uint32_t *plane_id, uint32_t crtc_id,
 			continue;
 		}
 
+		if (!drm_get_object_prop(plane->plane_id, DRM_MODE_OBJECT_PLANE, "type", &plane_type) ||
+		    plane_type != type) {
+			drmModeFreePlane(plane);
+			continue;
+		}
+
 		for (j = 0; j < plane->count_formats; ++j) {
-			if (plane->formats[j] == format)
+			if (!format || plane->formats[j] == format)
 				break;
 		}
 
@@ -521,8 +1242,30 @@ err:
 	return -1;
 }
 
-static int drm_setup(unsigned int fourcc)
+/* Pick the cheapest format of drm_formats the primary plane supports */
+static int drm_choose_format(void)
+{
+	uint32_t i, j;
+
+	for (i = 0; i < sizeof(drm_formats) / sizeof(drm_formats[0]); i++) {
+		for (j = 0; j < drm_dev.plane->count_formats; j++) {
+			if (drm_dev.plane->formats[j] != drm_formats[i].fourcc)
+				continue;
+
+			drm_dev.fourcc = drm_formats[i].fourcc;
+			drm_dev.bpp = drm_formats[i].bpp;
+			drm_dev.cpp = drm_formats[i].bpp / 8;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+static int drm_setup(void)
 {
+	unsigned int fourcc;
+	uint64_t cap;
 	int ret;
 
 	drm_dev.fd = drm_open(DRM_CARD);
@@ -541,18 +1284,35 @@ static int drm_setup(unsigned int fourcc)
 		goto err;
 	}
 
-	ret = find_plane(fourcc, &drm_dev.plane_id, drm_dev.crtc_id, drm_dev.crtc_idx);
+	ret = find_plane(0, &drm_dev.plane_id, drm_dev.crtc_id, drm_dev.crtc_idx,
+			 DRM_PLANE_TYPE_PRIMARY);
 	if (ret) {
 		err("Cannot find plane");
 		goto err;
 	}
 
+	/* Optional planes for the pointer and an overlay display */
+	if (find_plane(DRM_FORMAT_ARGB8888, &drm_dev.cursor_plane_id, drm_dev.crtc_id,
+		       drm_dev.crtc_idx, DRM_PLANE_TYPE_CURSOR))
+		drm_dev.cursor_plane_id = 0;
+
+	if (find_plane(DRM_FORMAT_ARGB8888, &drm_dev.overlay_plane_id, drm_dev.crtc_id,
+		       drm_dev.crtc_idx, DRM_PLANE_TYPE_OVERLAY))
+		drm_dev.overlay_plane_id = 0;
+
 	drm_dev.plane = drmModeGetPlane(drm_dev.fd, drm_dev.plane_id);
 	if (!drm_dev.plane) {
 		err("Cannot get plane");
 		goto err;
 	}
 
+	ret = drm_choose_format();
+	if (ret) {
+		err("No usable pixel format on plane %u", drm_dev.plane_id);
+		goto err;
+	}
+	fourcc = drm_dev.fourcc;
+
 	drm_dev.crtc = drmModeGetCrtc(drm_dev.fd, drm_dev.crtc_id);
 	if (!drm_dev.crtc) {
 		err("Cannot get crtc");
@@ -583,9 +1343,50 @@ static int drm_setup(unsigned int fourcc)
 		goto err;
 	}
 
+	ret = drm_resolve_props();
+	if (ret) {
+		err("Cannot resolve props");
+		goto err;
+	}
+
+	drm_dev.gamma_size = 0;
+	if (drm_dev.props[DRM_PROP_GAMMA_LUT].prop_id)
+		drm_get_object_prop(drm_dev.crtc_id, DRM_MODE_OBJECT_CRTC, "GAMMA_LUT_SIZE",
+				    &drm_dev.gamma_size);
+	if (!drm_dev.gamma_size)
+		drm_dev.props[DRM_PROP_GAMMA_LUT].prop_id = 0;
+	drm_dev.color_cur = 0;
+	drm_dev.color_dirty = 0;
+
+	/* The enum values of a bitmask property are bit numbers */
+	drm_dev.rotations = 0;
+	if (drm_dev.props[DRM_PROP_ROTATION].prop_id) {
+		drmModePropertyPtr prop = drmModeGetProperty(drm_dev.fd,
+							     drm_dev.props[DRM_PROP_ROTATION].prop_id);
+		int i;
+
+		for (i = 0; prop && i < prop->count_enums; i++)
+			drm_dev.rotations |= 1ULL << prop->enums[i].value;
+		drmModeFreeProperty(prop);
+	}
+
+	drm_dev.req = drmModeAtomicAlloc();
+	if (!drm_dev.req) {
+		err("Cannot allocate atomic request");
+		goto err;
+	}
+
+#ifdef DRM_CAP_ATOMIC_ASYNC_PAGE_FLIP
+	if (!drmGetCap(drm_dev.fd, DRM_CAP_ATOMIC_ASYNC_PAGE_FLIP, &cap))
+		drm_dev.async_cap = cap;
+#endif
+	drm_dev.present_mode = DRM_PRESENT_FIFO;
+	drm_dev.vblank_us = 0;
+	drm_dev.render_start_us = 0;
+	drm_dev.render_us = 0;
+
 	drm_dev.drm_event_ctx.version = DRM_EVENT_CONTEXT_VERSION;
 	drm_dev.drm_event_ctx.page_flip_handler = page_flip_handler;
-	drm_dev.fourcc = fourcc;
 
 	info("drm: Found plane_id: %u connector_id: %d crtc_id: %d",
 		drm_dev.plane_id, drm_dev.conn_id, drm_dev.crtc_id);
@@ -594,6 +1395,9 @@ static int drm_setup(unsigned int fourcc)
 	     drm_dev.width, drm_dev.height, drm_dev.mmWidth, drm_dev.mmHeight,
 	     (fourcc>>0)&0xff, (fourcc>>8)&0xff, (fourcc>>16)&0xff, (fourcc>>24)&0xff);
 
+	if (!DRM_FORMAT_IS_NATIVE(fourcc))
+		info("drm: converting from %d bit LVGL colors", LV_COLOR_DEPTH);
+
 	return 0;
 
 err:
@@ -601,7 +1405,8 @@ err:
 	return -1;
 }
 
-static int drm_allocate_dumb(struct drm_buffer *buf)
+static int drm_allocate_dumb(struct drm_buffer *buf, uint32_t width, uint32_t height,
+			     uint32_t bpp, uint32_t fourcc)
 {
 	struct drm_mode_create_dumb creq;
 	struct drm_mode_map_dumb mreq;
@@ -610,9 +1415,9 @@ static int drm_allocate_dumb(struct drm_buffer *buf)
 
 	/* create dumb buffer */
 	memset(&creq, 0, sizeof(creq));
-	creq.width = drm_dev.width;
-	creq.height = drm_dev.height;
-	creq.bpp = LV_COLOR_DEPTH;
+	creq.width = width;
+	creq.height = height;
+	creq.bpp = bpp;
 	ret = drmIoctl(drm_dev.fd, DRM_IOCTL_MODE_CREATE_DUMB, &creq);
 	if (ret < 0) {
 		err("DRM_IOCTL_MODE_CREATE_DUMB fail");
@@ -650,7 +1455,7 @@ static int drm_allocate_dumb(struct drm_buffer *buf)
 	handles[0] = creq.handle;
 	pitches[0] = creq.pitch;
 	offsets[0] = 0;
-	ret = drmModeAddFB2(drm_dev.fd, drm_dev.width, drm_dev.height, drm_dev.fourcc,
+	ret = drmModeAddFB2(drm_dev.fd, width, height, fourcc,
 			    handles, pitches, offsets, &buf->fb_handle, 0);
 	if (ret) {
 		err("drmModeAddFB fail");
@@ -660,135 +1465,856 @@ static int drm_allocate_dumb(struct drm_buffer *buf)
 	return 0;
 }
 
-static int drm_setup_buffers(void)
+static void drm_destroy_dumb(struct drm_buffer *buf)
 {
-	int ret;
+	struct drm_mode_destroy_dumb dreq;
 
-	/* Allocate DUMB buffers */
-	ret = drm_allocate_dumb(&drm_dev.drm_bufs[0]);
-	if (ret)
-		return ret;
+	if (buf->fb_handle)
+		drmModeRmFB(drm_dev.fd, buf->fb_handle);
 
-	ret = drm_allocate_dumb(&drm_dev.drm_bufs[1]);
-	if (ret)
-		return ret;
+	if (buf->map && buf->map != MAP_FAILED)
+		munmap(buf->map, buf->size);
 
-	/* Set buffering handling */
-	drm_dev.cur_bufs[0] = NULL;
-	drm_dev.cur_bufs[1] = &drm_dev.drm_bufs[0];
+	if (buf->handle) {
+		memset(&dreq, 0, sizeof(dreq));
+		dreq.handle = buf->handle;
+		drmIoctl(drm_dev.fd, DRM_IOCTL_MODE_DESTROY_DUMB, &dreq);
+	}
 
-	return 0;
+	memset(buf, 0, sizeof(*buf));
 }
 
-void drm_wait_vsync(lv_disp_drv_t *disp_drv)
+static int drm_setup_buffers(void)
 {
-	int ret;
-	fd_set fds;
-	FD_ZERO(&fds);
-	FD_SET(drm_dev.fd, &fds);
+	int i, ret;
 
-	do {
-		ret = select(drm_dev.fd + 1, &fds, NULL, NULL, NULL);
-	} while (ret == -1 && errno == EINTR);
+	/* Allocate DUMB buffers */
+	for (i = 0; i < DRM_BUFFER_COUNT; i++) {
+		ret = drm_allocate_dumb(&drm_dev.drm_bufs[i], drm_dev.fb_width, drm_dev.fb_height,
+					drm_dev.bpp, drm_dev.fourcc);
+		if (ret)
+			return ret;
 
-	if (ret < 0) {
-		err("select failed: %s", strerror(errno));
-		drmModeAtomicFree(drm_dev.req);
-		drm_dev.req = NULL;
-		return;
+		drm_dev.drm_bufs[i].state = DRM_BUFFER_FREE;
 	}
 
-	if (FD_ISSET(drm_dev.fd, &fds))
-		drmHandleEvent(drm_dev.fd, &drm_dev.drm_event_ctx);
+	/* Buffers and shadow start out cleared, i.e. equal */
+	drm_dev.shadow = calloc(1, drm_dev.drm_bufs[0].size);
+	if (!drm_dev.shadow) {
+		err("cannot allocate shadow buffer");
+		return -1;
+	}
 
-	drmModeAtomicFree(drm_dev.req);
-	drm_dev.req = NULL;
+	drm_dev.back = NULL;
+	drm_dev.direct = 0;
+	drm_dev.front = NULL;
+	drm_dev.pending = NULL;
+	drm_dev.queue_len = 0;
+
+	return 0;
 }
 
-void drm_flush(lv_disp_drv_t *disp_drv, const lv_area_t *area, lv_color_t *color_p)
+static void drm_free_buffers(void)
 {
-	struct drm_buffer *fbuf = drm_dev.cur_bufs[1];
-	lv_coord_t w = (area->x2 - area->x1 + 1);
-	lv_coord_t h = (area->y2 - area->y1 + 1);
-	int i, y;
+	int i;
 
-	dbg("x %d:%d y %d:%d w %d h %d", area->x1, area->x2, area->y1, area->y2, w, h);
+	for (i = 0; i < DRM_BUFFER_COUNT; i++)
+		drm_destroy_dumb(&drm_dev.drm_bufs[i]);
 
-	/* Partial update */
-	if ((w != drm_dev.width || h != drm_dev.height) && drm_dev.cur_bufs[0])
-		memcpy(fbuf->map, drm_dev.cur_bufs[0]->map, fbuf->size);
+	for (i = 0; i < 2; i++)
+		drm_destroy_dumb(&drm_dev.ovl_bufs[i]);
 
-	for (y = 0, i = area->y1 ; i <= area->y2 ; ++i, ++y) {
-                memcpy((uint8_t *)fbuf->map + (area->x1 * (LV_COLOR_SIZE/8)) + (fbuf->pitch * i),
-                       (uint8_t *)color_p + (w * (LV_COLOR_SIZE/8) * y),
-		       w * (LV_COLOR_SIZE/8));
-	}
+	drm_destroy_dumb(&drm_dev.cursor_buf);
 
-	if (drm_dev.req)
-		drm_wait_vsync(disp_drv);
+	free(drm_dev.shadow);
+	drm_dev.shadow = NULL;
+}
 
-	/* show fbuf plane */
-	if (drm_dmabuf_set_plane(fbuf)) {
-		err("Flush fail");
-		return;
-	}
-	else
-		dbg("Flush done");
+/*
+ * Allocate the buffers for LVGL rendering at num/den of the mode size, with
+ * DRM_ROTATION done by the plane if plane_rotation is set, else in software.
+ * A test commit tells whether the plane can scale and rotate them.
+ */
+static int drm_try_buffers(uint32_t plane_rotation, uint32_t num, uint32_t den)
+{
+	uint32_t width = drm_dev.width * num / den;
+	uint32_t height = drm_dev.height * num / den;
+	int ret;
 
-	if (!drm_dev.cur_bufs[0])
-		drm_dev.cur_bufs[1] = &drm_dev.drm_bufs[1];
-	else
-		drm_dev.cur_bufs[1] = drm_dev.cur_bufs[0];
+	drm_dev.lv_width = DRM_ROTATION_SWAPS_AXES ? height : width;
+	drm_dev.lv_height = DRM_ROTATION_SWAPS_AXES ? width : height;
+	drm_dev.plane_rotation = plane_rotation;
+	drm_dev.sw_rotation = plane_rotation == DRM_MODE_ROTATE_0 ? DRM_ROTATION : DRM_MODE_ROTATE_0;
 
-	drm_dev.cur_bufs[0] = fbuf;
+	/* The plane scans out LVGL's orientation, or the buffers are in the mode's */
+	drm_dev.fb_width = plane_rotation == DRM_MODE_ROTATE_0 ? width : drm_dev.lv_width;
+	drm_dev.fb_height = plane_rotation == DRM_MODE_ROTATE_0 ? height : drm_dev.lv_height;
 
-	lv_disp_flush_ready(disp_drv);
+	ret = drm_setup_buffers();
+	if (ret || (num == den && plane_rotation == DRM_MODE_ROTATE_0))
+		return ret;
+
+	ret = drm_dmabuf_set_plane(&drm_dev.drm_bufs[0], NULL, NULL, drm_dev.color_cur,
+				   DRM_MODE_ATOMIC_TEST_ONLY);
+	if (ret)
+		drm_free_buffers();
+
+	return ret;
+}
+
+/*
+ * Prefer the plane to rotate and to scale the reduced render size up to the
+ * mode, give up scaling first, then rotate in software.
+ */
+static int drm_setup_scaled_buffers(void)
+{
+	uint32_t rotation = DRM_ROTATION;
+	int ret;
+
+	if (rotation != DRM_MODE_ROTATE_0 && (rotation & ~drm_dev.rotations)) {
+		info("drm: plane lacks rotation 0x%x, rotating in software", rotation);
+		rotation = DRM_MODE_ROTATE_0;
+	}
+
+	for (;;) {
+		ret = drm_try_buffers(rotation, DRM_RENDER_SCALE_NUM, DRM_RENDER_SCALE_DEN);
+		if (!ret && DRM_RENDER_SCALE_NUM != DRM_RENDER_SCALE_DEN)
+			info("drm: rendering at %ux%u, scaled to %ux%u by the plane",
+			     drm_dev.fb_width, drm_dev.fb_height, drm_dev.width, drm_dev.height);
+
+		if (ret && DRM_RENDER_SCALE_NUM != DRM_RENDER_SCALE_DEN) {
+			info("drm: plane can't scale to %ux%u%s, rendering at native size",
+			     drm_dev.width, drm_dev.height,
+			     rotation != DRM_MODE_ROTATE_0 ? " rotated" : "");
+			ret = drm_try_buffers(rotation, 1, 1);
+		}
+
+		if (!ret || rotation == DRM_MODE_ROTATE_0)
+			break;
+
+		info("drm: plane can't do rotation 0x%x, rotating in software", rotation);
+		rotation = DRM_MODE_ROTATE_0;
+	}
+
+	if (!ret && drm_dev.plane_rotation != DRM_MODE_ROTATE_0)
+		info("drm: rotation 0x%x done by the plane", drm_dev.plane_rotation);
+
+	return ret;
+}
+
+/* Convert a row of LVGL colors to the plane format, a copy if it is native */
+static void drm_convert_row(void *dst, const lv_color_t *src, uint32_t px)
+{
+	switch (drm_dev.fourcc) {
+	case DRM_FORMAT_XRGB8888:
+	case DRM_FORMAT_ARGB8888:
+		pixconv_lv_to_xrgb8888(dst, src, px);
+		break;
+	case DRM_FORMAT_XBGR8888:
+	case DRM_FORMAT_ABGR8888:
+		pixconv_lv_to_xbgr8888(dst, src, px);
+		break;
+	case DRM_FORMAT_RGB888:
+		pixconv_lv_to_rgb888(dst, src, px);
+		break;
+	case DRM_FORMAT_BGR888:
+		pixconv_lv_to_bgr888(dst, src, px);
+		break;
+	case DRM_FORMAT_RGB565:
+		pixconv_lv_to_rgb565(dst, src, px);
+		break;
+	case DRM_FORMAT_BGR565:
+		pixconv_lv_to_bgr565(dst, src, px);
+		break;
+	case DRM_FORMAT_RGB332:
+		pixconv_lv_to_rgb332(dst, src, px);
+		break;
+	}
+}
+
+/* Copy an area from the shadow to a buffer */
+static void drm_copy_from_shadow(struct drm_buffer *buf, const lv_area_t *area)
+{
+	uint32_t offset = area->x1 * drm_dev.cpp;
+	uint32_t len = lv_area_get_width(area) * drm_dev.cpp;
+	int y;
+
+	for (y = area->y1; y <= area->y2; y++)
+		pixconv_copy_stream((uint8_t *)buf->map + buf->pitch * y + offset,
+				    drm_dev.shadow + buf->pitch * y + offset, len);
+}
+
+/* Where LVGL's pixel x,y ends up after rotation, in drm_rect_rotate()'s terms */
+static void drm_rotate_point(uint32_t rotation, int32_t x, int32_t y, int32_t *rx, int32_t *ry)
+{
+	int32_t w = drm_dev.lv_width, h = drm_dev.lv_height;
+
+	if (rotation & DRM_MODE_REFLECT_X)
+		x = w - 1 - x;
+	if (rotation & DRM_MODE_REFLECT_Y)
+		y = h - 1 - y;
+
+	switch (rotation & DRM_MODE_ROTATE_MASK) {
+	case DRM_MODE_ROTATE_90:
+		*rx = y;
+		*ry = w - 1 - x;
+		break;
+	case DRM_MODE_ROTATE_180:
+		*rx = w - 1 - x;
+		*ry = h - 1 - y;
+		break;
+	case DRM_MODE_ROTATE_270:
+		*rx = h - 1 - y;
+		*ry = x;
+		break;
+	default:
+		*rx = x;
+		*ry = y;
+		break;
+	}
+}
+
+/*
+ * Convert an area of LVGL colors into the shadow with drm_dev.sw_rotation
+ * applied, in tiles so the scattered writes of a turn stay in the cache.
+ * rot is set to the area in buffer coordinates.
+ */
+static void drm_rotate_to_shadow(const lv_area_t *area, const lv_color_t *color_p,
+				 uint32_t pitch, lv_area_t *rot)
+{
+	lv_coord_t w = lv_area_get_width(area);
+	uint32_t cpp = drm_dev.cpp;
+	union {
+		uint32_t px32[DRM_ROTATE_TILE];
+		uint16_t px16[DRM_ROTATE_TILE];
+		uint8_t px8[DRM_ROTATE_TILE * 4];
+	} tmp; /* a converted tile row, aligned for every pixel size */
+	int32_t x0, y0, x1, y1, tx, ty, tw, th, x, y;
+	ptrdiff_t dx, dy;
+	uint8_t *origin, *dst;
+
+	drm_rotate_point(drm_dev.sw_rotation, area->x1, area->y1, &x0, &y0);
+	drm_rotate_point(drm_dev.sw_rotation, area->x2, area->y2, &x1, &y1);
+	rot->x1 = LV_MATH_MIN(x0, x1);
+	rot->y1 = LV_MATH_MIN(y0, y1);
+	rot->x2 = LV_MATH_MAX(x0, x1);
+	rot->y2 = LV_MATH_MAX(y0, y1);
+
+	/* Bytes to step in the shadow for a pixel right and a row down in LVGL */
+	origin = drm_dev.shadow + y0 * pitch + x0 * cpp;
+	drm_rotate_point(drm_dev.sw_rotation, area->x1 + 1, area->y1, &x1, &y1);
+	dx = (ptrdiff_t)(y1 - y0) * pitch + (ptrdiff_t)(x1 - x0) * cpp;
+	drm_rotate_point(drm_dev.sw_rotation, area->x1, area->y1 + 1, &x1, &y1);
+	dy = (ptrdiff_t)(y1 - y0) * pitch + (ptrdiff_t)(x1 - x0) * cpp;
+
+	for (ty = 0; ty < lv_area_get_height(area); ty += DRM_ROTATE_TILE) {
+		th = LV_MATH_MIN(DRM_ROTATE_TILE, lv_area_get_height(area) - ty);
+
+		for (tx = 0; tx < w; tx += DRM_ROTATE_TILE) {
+			tw = LV_MATH_MIN(DRM_ROTATE_TILE, w - tx);
+
+			for (y = ty; y < ty + th; y++) {
+				drm_convert_row(tmp.px8, color_p + w * y + tx, tw);
+				dst = origin + tx * dx + y * dy;
+
+				/* Fixed size copies become single stores */
+				switch (cpp) {
+				case 4:
+					for (x = 0; x < tw; x++, dst += dx)
+						memcpy(dst, &tmp.px32[x], 4);
+					break;
+				case 2:
+					for (x = 0; x < tw; x++, dst += dx)
+						memcpy(dst, &tmp.px16[x], 2);
+					break;
+				default:
+					for (x = 0; x < tw; x++, dst += dx)
+						memcpy(dst, &tmp.px8[x * cpp], cpp);
+					break;
+				}
+			}
+		}
+	}
+}
+
+/*
+ * Bring a buffer to the state of the last frame by copying what changed
+ * since it was drawn (its age) from the shadow, or everything if it is older
+ * than the damage history.
+ */
+static void drm_buffer_catch_up(struct drm_buffer *buf)
+{
+	uint32_t age = drm_dev.frame_seq - buf->seq;
+	uint32_t seq, i;
+
+	if (age == 0)
+		return;
+
+	if (age >= DRM_DAMAGE_HISTORY) {
+		dbg("buffer too old (%u frames), full copy", age);
+		pixconv_copy_stream(buf->map, drm_dev.shadow, buf->size);
+	} else {
+		for (seq = buf->seq + 1; seq <= drm_dev.frame_seq; seq++) {
+			struct drm_damage *d = &drm_dev.damage[seq % DRM_DAMAGE_HISTORY];
+			for (i = 0; i < d->count; i++)
+				drm_copy_from_shadow(buf, &d->rects[i]);
+		}
+	}
+
+	buf->seq = drm_dev.frame_seq;
+}
+
+void drm_wait_vsync(lv_disp_drv_t *disp_drv)
+{
+	/* Wait until the presentation thread has shown everything */
+	pthread_mutex_lock(&drm_dev.lock);
+	while (drm_dev.queue_len || drm_dev.flip_pending)
+		pthread_cond_wait(&drm_dev.cond, &drm_dev.lock);
+	pthread_mutex_unlock(&drm_dev.lock);
+}
+
+/*
+ * A frame was finished at now_us, learn how long rendering takes. Quick to
+ * follow a slower frame, slow to trust faster ones.
+ */
+static void drm_render_done(uint64_t now_us)
+{
+	uint32_t sample;
+
+	if (!drm_dev.render_start_us || now_us <= drm_dev.render_start_us)
+		return;
+
+	sample = now_us - drm_dev.render_start_us;
+	if (sample > drm_dev.render_us)
+		drm_dev.render_us = sample;
+	else
+		drm_dev.render_us -= (drm_dev.render_us - sample) / 16;
+
+	drm_dev.render_start_us = 0;
+}
+
+/*
+ * Queue a finished frame for the presentation thread. LVGL may go on as soon
+ * as another buffer is free, right away with spare buffers, otherwise from
+ * the page flip event.
+ */
+static void drm_present_queue(lv_disp_drv_t *disp_drv, struct drm_buffer *fbuf)
+{
+	uint32_t i;
+
+	pthread_mutex_lock(&drm_dev.lock);
+
+	/*
+	 * The presentation thread gets a copy of the frame's damage, the ring
+	 * is LVGL's and already takes the next frame while this one waits.
+	 */
+	if (drm_dev.direct)
+		fbuf->damage.count = 0;
+	else
+		fbuf->damage = drm_dev.damage[drm_dev.frame_seq % DRM_DAMAGE_HISTORY];
+
+	/* Mailbox: the new frame replaces those not committed yet, and takes their damage */
+	if (drm_dev.present_mode == DRM_PRESENT_MAILBOX) {
+		for (i = 0; i < drm_dev.queue_len; i++) {
+			drm_damage_merge(&fbuf->damage, &drm_dev.queue[i]->damage);
+			drm_dev.queue[i]->state = DRM_BUFFER_FREE;
+		}
+		drm_dev.stats.dropped_frames += drm_dev.queue_len;
+		drm_dev.queue_len = 0;
+	}
+
+	fbuf->state = DRM_BUFFER_QUEUED;
+	drm_dev.queue[drm_dev.queue_len++] = fbuf;
+	drm_dev.ready_drv = disp_drv;
+	drm_present_release();
+	pthread_mutex_unlock(&drm_dev.lock);
 }
 
+int drm_disp_buf_init(lv_disp_buf_t *disp_buf)
+{
+	if (DRM_BUFFER_COUNT != 2) {
+		err("direct mode needs DRM_BUFFER_COUNT 2, LVGL alternates two buffers");
+		return -1;
+	}
+
+	if (!DRM_FORMAT_IS_NATIVE(drm_dev.fourcc)) {
+		err("direct mode needs a plane format matching LV_COLOR_DEPTH");
+		return -1;
+	}
+
+	if (drm_dev.sw_rotation != DRM_MODE_ROTATE_0) {
+		err("direct mode needs the plane to do DRM_ROTATION");
+		return -1;
+	}
+
+	if (drm_dev.drm_bufs[0].pitch != drm_dev.fb_width * drm_dev.cpp) {
+		err("direct mode needs unpadded lines, pitch is %u", drm_dev.drm_bufs[0].pitch);
+		return -1;
+	}
+
+	/* LVGL keeps the buffers in sync itself */
+	free(drm_dev.shadow);
+	drm_dev.shadow = NULL;
+	drm_dev.direct = 1;
+
+	lv_disp_buf_init(disp_buf, drm_dev.drm_bufs[0].map, drm_dev.drm_bufs[1].map,
+			 drm_dev.fb_width * drm_dev.fb_height);
+
+	return 0;
+}
+
+void drm_flush(lv_disp_drv_t *disp_drv, const lv_area_t *area, lv_color_t *color_p)
+{
+	struct drm_buffer *fbuf = drm_dev.back;
+	lv_coord_t w = (area->x2 - area->x1 + 1);
+	lv_area_t rot;
+	int i, y;
+
+	dbg("x %d:%d y %d:%d w %d", area->x1, area->x2, area->y1, area->y2, w);
+
+	if (drm_dev.direct) {
+		/* color_p is the mapping LVGL drew the whole frame into, just show it */
+		if (!lv_disp_flush_is_last(disp_drv)) {
+			lv_disp_flush_ready(disp_drv);
+			return;
+		}
+
+		fbuf = (void *)color_p == drm_dev.drm_bufs[0].map ? &drm_dev.drm_bufs[0] : &drm_dev.drm_bufs[1];
+		fbuf->start_us = drm_now_us(); /* drawing is not seen here */
+		drm_render_done(fbuf->start_us);
+		drm_present_queue(disp_drv, fbuf);
+		return;
+	}
+
+	/* First area of a frame */
+	if (!fbuf) {
+		/* Take a free buffer of the swapchain, LVGL was only released if there is one */
+		pthread_mutex_lock(&drm_dev.lock);
+		while (!(fbuf = drm_buffer_find_free()))
+			pthread_cond_wait(&drm_dev.cond, &drm_dev.lock);
+		fbuf->state = DRM_BUFFER_DRAWING;
+		pthread_mutex_unlock(&drm_dev.lock);
+
+		fbuf->start_us = drm_now_us();
+
+		/* Partial update: the buffer misses the frames drawn since it was shown */
+		drm_buffer_catch_up(fbuf);
+
+		drm_dev.damage[(drm_dev.frame_seq + 1) % DRM_DAMAGE_HISTORY].count = 0;
+		drm_dev.back = fbuf;
+	}
+
+	/* Draw to the shadow in the plane format, then stream to the write-combined buffer */
+	if (drm_dev.sw_rotation != DRM_MODE_ROTATE_0) {
+		drm_rotate_to_shadow(area, color_p, fbuf->pitch, &rot);
+		area = &rot;
+	} else {
+		for (y = 0, i = area->y1 ; i <= area->y2 ; ++i, ++y)
+			drm_convert_row(drm_dev.shadow + (area->x1 * drm_dev.cpp) + (fbuf->pitch * i),
+					color_p + (w * y), w);
+	}
+	drm_copy_from_shadow(fbuf, area);
+	drm_damage_add(&drm_dev.damage[(drm_dev.frame_seq + 1) % DRM_DAMAGE_HISTORY], area);
+
+	/* Collect all areas of the frame in the back buffer, show it once */
+	if (!lv_disp_flush_is_last(disp_drv)) {
+		lv_disp_flush_ready(disp_drv);
+		return;
+	}
+
+	pixconv_stream_fence();
+	drm_dev.back = NULL;
+	drm_dev.frame_seq++;
+	fbuf->seq = drm_dev.frame_seq;
+
+	drm_render_done(drm_now_us());
+	drm_present_queue(disp_drv, fbuf);
+}
+
+/* Called with drm_dev.lock held */
+static void drm_cursor_update(uint32_t fb)
+{
+	drm_dev.cursor.fb = fb;
+	drm_dev.cursor.x = drm_dev.cursor_pos_x - drm_dev.cursor_hot_x;
+	drm_dev.cursor.y = drm_dev.cursor_pos_y - drm_dev.cursor_hot_y;
+	drm_dev.cursor_dirty = 1;
+	pthread_cond_broadcast(&drm_dev.cond);
+}
+
+int drm_cursor_set_image(const lv_img_dsc_t *img, lv_coord_t hot_x, lv_coord_t hot_y)
+{
+	struct drm_buffer *buf = &drm_dev.cursor_buf;
+	uint32_t px_size, x, y;
+	uint64_t cap;
+
+	if (!drm_dev.cursor_plane_id) {
+		err("no cursor plane");
+		return -1;
+	}
+
+	if (!img) {
+		pthread_mutex_lock(&drm_dev.lock);
+		drm_cursor_update(0);
+		pthread_mutex_unlock(&drm_dev.lock);
+		return 0;
+	}
+
+	if (img->header.cf == LV_IMG_CF_TRUE_COLOR_ALPHA) {
+		px_size = LV_IMG_PX_SIZE_ALPHA_BYTE;
+	} else if (img->header.cf == LV_IMG_CF_TRUE_COLOR) {
+		px_size = sizeof(lv_color_t);
+	} else {
+		err("cursor image must be true color");
+		return -1;
+	}
+
+	/* Cursor planes often take nothing but their own size */
+	if (!buf->map) {
+		drm_dev.cursor_w = drmGetCap(drm_dev.fd, DRM_CAP_CURSOR_WIDTH, &cap) ? 64 : cap;
+		drm_dev.cursor_h = drmGetCap(drm_dev.fd, DRM_CAP_CURSOR_HEIGHT, &cap) ? 64 : cap;
+
+		if (drm_allocate_dumb(buf, drm_dev.cursor_w, drm_dev.cursor_h, 32, DRM_FORMAT_ARGB8888)) {
+			err("cannot allocate cursor buffer");
+			drm_destroy_dumb(buf);
+			return -1;
+		}
+	}
+
+	if (img->header.w > drm_dev.cursor_w || img->header.h > drm_dev.cursor_h) {
+		err("cursor image larger than %ux%u", drm_dev.cursor_w, drm_dev.cursor_h);
+		return -1;
+	}
+
+	/* The plane blends premultiplied ARGB, pad with transparent pixels */
+	for (y = 0; y < drm_dev.cursor_h; y++) {
+		uint32_t *dst = (uint32_t *)((uint8_t *)buf->map + buf->pitch * y);
+
+		for (x = 0; x < drm_dev.cursor_w; x++) {
+			const uint8_t *px;
+			lv_color_t c;
+			uint32_t rgb, a;
+
+			if (x >= img->header.w || y >= img->header.h) {
+				dst[x] = 0;
+				continue;
+			}
+
+			px = img->data + (y * img->header.w + x) * px_size;
+			memcpy(&c, px, sizeof(c));
+			rgb = lv_color_to32(c);
+			a = px_size == LV_IMG_PX_SIZE_ALPHA_BYTE ? px[px_size - 1] : 0xFF;
+
+			dst[x] = a << 24 |
+				 (((rgb >> 16) & 0xFF) * a / 255) << 16 |
+				 (((rgb >> 8) & 0xFF) * a / 255) << 8 |
+				 ((rgb & 0xFF) * a / 255);
+		}
+	}
+
+	pthread_mutex_lock(&drm_dev.lock);
+	drm_dev.cursor_hot_x = hot_x;
+	drm_dev.cursor_hot_y = hot_y;
+	drm_cursor_update(buf->fb_handle);
+	pthread_mutex_unlock(&drm_dev.lock);
+
+	return 0;
+}
+
+void drm_cursor_move(lv_coord_t x, lv_coord_t y)
+{
+	uint32_t width = DRM_ROTATION_SWAPS_AXES ? drm_dev.lv_height : drm_dev.lv_width;
+	uint32_t height = DRM_ROTATION_SWAPS_AXES ? drm_dev.lv_width : drm_dev.lv_height;
+	int32_t rx, ry;
+
+	pthread_mutex_lock(&drm_dev.lock);
+
+	/* From LVGL's to the mode's coordinates, the buffers may be rotated and scaled */
+	drm_rotate_point(DRM_ROTATION, x, y, &rx, &ry);
+	drm_dev.cursor_pos_x = rx * (int32_t)drm_dev.width / (int32_t)width;
+	drm_dev.cursor_pos_y = ry * (int32_t)drm_dev.height / (int32_t)height;
+	drm_cursor_update(drm_dev.cursor.fb);
+
+	pthread_mutex_unlock(&drm_dev.lock);
+}
+
+int drm_color_mod(uint8_t r, uint8_t g, uint8_t b)
+{
+	const uint8_t gain[3] = { r, g, b };
+	struct drm_color_lut *lut;
+	struct drm_color_ctm ctm;
+	uint32_t blob = 0, i;
+	int ret;
+
+	if (drm_dev.props[DRM_PROP_GAMMA_LUT].prop_id) {
+		/* Linear ramps scaled per channel */
+		lut = calloc(drm_dev.gamma_size, sizeof(*lut));
+		if (!lut)
+			return -1;
+
+		for (i = 0; i < drm_dev.gamma_size; i++) {
+			uint32_t v = i * 0xffff / (drm_dev.gamma_size - 1);
+
+			lut[i].red = v * gain[0] / 255;
+			lut[i].green = v * gain[1] / 255;
+			lut[i].blue = v * gain[2] / 255;
+		}
+
+		ret = drmModeCreatePropertyBlob(drm_dev.fd, lut, drm_dev.gamma_size * sizeof(*lut), &blob);
+		free(lut);
+	} else if (drm_dev.props[DRM_PROP_CTM].prop_id) {
+		/* Diagonal matrix, S31.32 sign-magnitude */
+		memset(&ctm, 0, sizeof(ctm));
+		for (i = 0; i < 3; i++)
+			ctm.matrix[i * 4] = ((uint64_t)gain[i] << 32) / 255;
+
+		ret = drmModeCreatePropertyBlob(drm_dev.fd, &ctm, sizeof(ctm), &blob);
+	} else {
+		err("CRTC has neither GAMMA_LUT nor CTM");
+		return -1;
+	}
+
+	if (ret) {
+		err("drmModeCreatePropertyBlob fail %d", errno);
+		return -1;
+	}
+
+	pthread_mutex_lock(&drm_dev.lock);
+	/* Replaces a value the thread didn't take yet */
+	if (drm_dev.color_dirty && drm_dev.color_next != drm_dev.color_cur)
+		drmModeDestroyPropertyBlob(drm_dev.fd, drm_dev.color_next);
+	drm_dev.color_next = blob;
+	drm_dev.color_dirty = 1;
+	pthread_cond_broadcast(&drm_dev.cond);
+	pthread_mutex_unlock(&drm_dev.lock);
+
+	return 0;
+}
+
+int drm_backlight(uint8_t level)
+{
+	return drm_color_mod(level, level, level);
+}
+
+int drm_overlay_disp_buf_init(lv_disp_buf_t *disp_buf)
+{
 #if LV_COLOR_DEPTH == 32
-#define DRM_FOURCC DRM_FORMAT_ARGB8888
-#elif LV_COLOR_DEPTH == 16
-#define DRM_FOURCC DRM_FORMAT_RGB565
+	int i;
+
+	if (!drm_dev.overlay_plane_id) {
+		err("no overlay plane");
+		return -1;
+	}
+
+	if (DRM_ROTATION != DRM_MODE_ROTATE_0) {
+		err("the overlay isn't rotated");
+		return -1;
+	}
+
+	for (i = 0; i < 2; i++) {
+		if (drm_allocate_dumb(&drm_dev.ovl_bufs[i], drm_dev.fb_width, drm_dev.fb_height,
+				      32, DRM_FORMAT_ARGB8888)) {
+			err("cannot allocate overlay buffers");
+			goto err;
+		}
+	}
+
+	if (drm_dev.ovl_bufs[0].pitch != drm_dev.fb_width * 4) {
+		err("overlay needs unpadded lines, pitch is %u", drm_dev.ovl_bufs[0].pitch);
+		goto err;
+	}
+
+	/* Like the zero-copy mode, LVGL keeps the two buffers in sync */
+	lv_disp_buf_init(disp_buf, drm_dev.ovl_bufs[0].map, drm_dev.ovl_bufs[1].map,
+			 drm_dev.fb_width * drm_dev.fb_height);
+
+	return 0;
+
+err:
+	for (i = 0; i < 2; i++)
+		drm_destroy_dumb(&drm_dev.ovl_bufs[i]);
+	return -1;
 #else
-#error LV_COLOR_DEPTH not supported
+	err("the overlay needs LV_COLOR_DEPTH 32 for its alpha channel");
+	return -1;
 #endif
+}
+
+void drm_overlay_flush(lv_disp_drv_t *disp_drv, const lv_area_t *area, lv_color_t *color_p)
+{
+	if (!lv_disp_flush_is_last(disp_drv)) {
+		lv_disp_flush_ready(disp_drv);
+		return;
+	}
+
+	/* Shown with the next commit, LVGL is released by its page flip */
+	pthread_mutex_lock(&drm_dev.lock);
+	drm_dev.ovl_queued = (void *)color_p == drm_dev.ovl_bufs[0].map ?
+			     &drm_dev.ovl_bufs[0] : &drm_dev.ovl_bufs[1];
+	drm_dev.ovl_drv = disp_drv;
+	pthread_cond_broadcast(&drm_dev.cond);
+	pthread_mutex_unlock(&drm_dev.lock);
+}
+
+drm_present_mode_t drm_set_present_mode(drm_present_mode_t mode)
+{
+	/* A spare buffer must be left to draw into while one waits to be committed */
+	if (mode == DRM_PRESENT_MAILBOX && DRM_BUFFER_COUNT < 4)
+		mode = DRM_PRESENT_FIFO;
+
+	if (mode == DRM_PRESENT_ASYNC && !drm_dev.async_cap)
+		mode = DRM_BUFFER_COUNT < 4 ? DRM_PRESENT_FIFO : DRM_PRESENT_MAILBOX;
+
+	pthread_mutex_lock(&drm_dev.lock);
+	drm_dev.present_mode = mode;
+	pthread_mutex_unlock(&drm_dev.lock);
+
+	info("drm: %s presentation", mode == DRM_PRESENT_ASYNC ? "async (tearing)" :
+	     mode == DRM_PRESENT_MAILBOX ? "mailbox" : "FIFO");
+
+	return mode;
+}
+
+drm_present_mode_t drm_get_present_mode(void)
+{
+	return drm_dev.present_mode;
+}
+
+uint32_t drm_render_delay_us(void)
+{
+	uint64_t now_us = drm_now_us(), vblank_us, ready_us;
+	uint32_t period = drm_frame_period_us();
+	uint32_t ahead, k;
+
+	pthread_mutex_lock(&drm_dev.lock);
+	vblank_us = drm_dev.vblank_us;
+	/* Frames that get a vblank before the next one */
+	ahead = drm_dev.flip_pending + drm_dev.queue_len;
+	pthread_mutex_unlock(&drm_dev.lock);
+
+	/* Nothing to align to yet, or flips don't wait for vblank */
+	if (!vblank_us || drm_dev.present_mode == DRM_PRESENT_ASYNC) {
+		drm_dev.render_start_us = now_us;
+		return 0;
+	}
+
+	/* First vblank the frame can make if started now, and not before the ones ahead */
+	ready_us = now_us + drm_dev.render_us + DRM_RENDER_MARGIN_US;
+	k = (ready_us - vblank_us + period - 1) / period;
+	if (k < ahead + 1)
+		k = ahead + 1;
+
+	drm_dev.render_start_us = vblank_us + (uint64_t)k * period - drm_dev.render_us - DRM_RENDER_MARGIN_US;
+
+	return drm_dev.render_start_us - now_us;
+}
+
+void drm_render_wait(void)
+{
+	uint32_t delay = drm_render_delay_us();
+
+	if (delay)
+		usleep(delay);
+}
+
+void drm_get_stats(drm_stats_t *stats)
+{
+	pthread_mutex_lock(&drm_dev.lock);
+	*stats = drm_dev.stats;
+	pthread_mutex_unlock(&drm_dev.lock);
+}
+
+void drm_reset_stats(void)
+{
+	pthread_mutex_lock(&drm_dev.lock);
+	memset(&drm_dev.stats, 0, sizeof(drm_dev.stats));
+	drm_dev.latency_sum_us = 0;
+	drm_dev.frame_time_sum_us = 0;
+	drm_dev.last_flip_us = 0;
+	pthread_mutex_unlock(&drm_dev.lock);
+}
+
+void drm_log_stats(void)
+{
+	pthread_mutex_lock(&drm_dev.lock);
+	drm_stats_log();
+	pthread_mutex_unlock(&drm_dev.lock);
+}
 
 void drm_get_sizes(lv_coord_t *width, lv_coord_t *height, uint32_t *dpi)
 {
+	uint32_t mm = DRM_ROTATION_SWAPS_AXES ? drm_dev.mmHeight : drm_dev.mmWidth;
+
 	if (width)
-		*width = drm_dev.width;
+		*width = drm_dev.lv_width;
 
 	if (height)
-		*height = drm_dev.height;
+		*height = drm_dev.lv_height;
 
-	if (dpi && drm_dev.mmWidth)
-		*dpi = DIV_ROUND_UP(drm_dev.width * 25400, drm_dev.mmWidth * 1000);
+	if (dpi && mm)
+		*dpi = DIV_ROUND_UP(drm_dev.lv_width * 25400, mm * 1000);
 }
 
 void drm_init(void)
 {
 	int ret;
 
-	ret = drm_setup(DRM_FOURCC);
+	pixconv_init();
+
+	ret = drm_setup();
 	if (ret) {
 		close(drm_dev.fd);
 		drm_dev.fd = -1;
 		return;
 	}
 
-	ret = drm_setup_buffers();
+	ret = drm_setup_scaled_buffers();
 	if (ret) {
 		err("DRM buffer allocation failed");
-		close(drm_dev.fd);
-		drm_dev.fd = -1;
-		return;
+		goto err;
+	}
+
+	pthread_mutex_init(&drm_dev.lock, NULL);
+	pthread_cond_init(&drm_dev.cond, NULL);
+	drm_dev.quit = 0;
+
+	ret = pthread_create(&drm_dev.present_thread, NULL, drm_present_thread, NULL);
+	if (ret) {
+		err("cannot create presentation thread: %s", strerror(ret));
+		goto err;
 	}
 
 	info("DRM subsystem and buffer mapped successfully");
+	return;
+
+err:
+	/* Leave nothing for drm_exit() to release */
+	drm_free_buffers();
+	drmModeAtomicFree(drm_dev.req);
+	drm_dev.req = NULL;
+	close(drm_dev.fd);
+	drm_dev.fd = -1;
 }
 
 void drm_exit(void)
 {
+	/* drm_init() failed and released everything */
+	if (drm_dev.fd < 0)
+		return;
+
+	pthread_mutex_lock(&drm_dev.lock);
+	drm_dev.quit = 1;
+	pthread_cond_broadcast(&drm_dev.cond);
+	pthread_mutex_unlock(&drm_dev.lock);
+	pthread_join(drm_dev.present_thread, NULL);
+
+	if (drm_dev.color_dirty && drm_dev.color_next != drm_dev.color_cur)
+		drmModeDestroyPropertyBlob(drm_dev.fd, drm_dev.color_next);
+	if (drm_dev.color_cur)
+		drmModeDestroyPropertyBlob(drm_dev.fd, drm_dev.color_cur);
+
+	drm_free_buffers();
+	drmModeAtomicFree(drm_dev.req);
+	drm_dev.req = NULL;
 	close(drm_dev.fd);
 	drm_dev.fd = -1;
 }
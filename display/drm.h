@@ -32,10 +32,31 @@ extern "C" {
 /*********************
  *      DEFINES
  *********************/
+#define DRM_STATS_HIST_SIZE 8
 
 /**********************
  *      TYPEDEFS
  **********************/
+typedef enum {
+    DRM_PRESENT_FIFO,       /*Every frame is shown, at a vblank*/
+    DRM_PRESENT_MAILBOX,    /*A newer frame replaces one still waiting, at a vblank*/
+    DRM_PRESENT_ASYNC,      /*Flip right away, may tear*/
+} drm_present_mode_t;
+
+/*Frame pacing measured from the page flip events, times in us of CLOCK_MONOTONIC*/
+typedef struct {
+    uint32_t frames;                /*Frames shown*/
+    uint32_t dropped_frames;        /*Replaced in the mailbox mode before being shown*/
+    uint32_t continuous_frames;     /*Of them, frames LVGL started right after or before the previous one was shown*/
+    uint32_t missed_vblanks;        /*Refreshes that repeated the old frame while LVGL was on a new one*/
+    uint32_t last_sequence;         /*Vblank counter of the last frame*/
+    uint64_t last_vblank_us;        /*Vblank timestamp of the last frame*/
+    uint32_t frame_time_avg_us;     /*Time between continuous frames*/
+    uint32_t frame_time_max_us;
+    uint32_t latency_avg_us;        /*Start of the flush to scanout*/
+    uint32_t latency_max_us;
+    uint32_t frame_time_hist[DRM_STATS_HIST_SIZE]; /*Continuous frames shown for 1, 2, ... and the last for more vblanks*/
+} drm_stats_t;
 
 /**********************
  * GLOBAL PROTOTYPES
@@ -46,6 +67,97 @@ void drm_exit(void);
 void drm_flush(lv_disp_drv_t * drv, const lv_area_t * area, lv_color_t * color_p);
 void drm_wait_vsync(lv_disp_drv_t * drv);
 
+/**
+ * Scale the colour channels in the display pipe (CRTC GAMMA_LUT, else CTM)
+ * instead of redrawing, for dimming, fades and night mode. Takes effect with
+ * the next commit, one per frame at most.
+ * @param r red gain, 255: unchanged, 0: off
+ * @param g green gain
+ * @param b blue gain
+ * @return 0 on success, -1 if the CRTC has no colour management
+ */
+int drm_color_mod(uint8_t r, uint8_t g, uint8_t b);
+
+/**
+ * Dim the whole screen, like monitor_backlight()
+ * @param level 255: full brightness, 0: black
+ * @return 0 on success, -1 if the CRTC has no colour management
+ */
+int drm_backlight(uint8_t level);
+
+/**
+ * Select how finished frames are presented, FIFO by default. The mailbox mode
+ * needs DRM_BUFFER_COUNT 4, the async mode atomic async flip support.
+ * @param mode the wanted mode
+ * @return the mode in effect, a fallback if the wanted one isn't available
+ */
+drm_present_mode_t drm_set_present_mode(drm_present_mode_t mode);
+drm_present_mode_t drm_get_present_mode(void);
+
+/**
+ * Time until the main loop should render so the frame is flushed just before
+ * the vblank it can make, predicted from the flip events and the measured
+ * render time. Rendering is expected to start then, e.g.
+ * `usleep(drm_render_delay_us()); lv_task_handler(); lv_refr_now(NULL);`
+ * @return microseconds to wait, 0 to render right away
+ */
+uint32_t drm_render_delay_us(void);
+
+/**
+ * Sleep for drm_render_delay_us()
+ */
+void drm_render_wait(void);
+
+/**
+ * Get the frame statistics collected since drm_init() or drm_reset_stats()
+ * @param stats filled with a consistent copy
+ */
+void drm_get_stats(drm_stats_t * stats);
+void drm_reset_stats(void);
+
+/**
+ * Print the frame statistics, also done every DRM_STATS_LOG_PERIOD seconds if set
+ */
+void drm_log_stats(void);
+
+/**
+ * Zero-copy mode: use the mapped DRM buffers as LVGL's screen sized double
+ * buffers, so drm_flush() only flips them. Call after drm_init() instead of
+ * lv_disp_buf_init(). LVGL then draws into (often uncached) video memory,
+ * which pays off when little is redrawn per frame.
+ * @param disp_buf the display buffer to initialize
+ * @return 0 on success, -1 if the buffers can't be used directly
+ */
+int drm_disp_buf_init(lv_disp_buf_t * disp_buf);
+
+/**
+ * Show an image on the cursor plane instead of drawing the pointer with LVGL.
+ * The plane is moved with drm_cursor_move(), e.g. from the input read_cb.
+ * The image isn't turned by DRM_ROTATION, it is shown as it is on the panel.
+ * @param img LV_IMG_CF_TRUE_COLOR(_ALPHA) image up to the plane's size (usually 64x64), NULL to hide
+ * @param hot_x x offset of the pointer's tip in the image
+ * @param hot_y y offset of the pointer's tip in the image
+ * @return 0 on success, -1 if there is no cursor plane or the image doesn't fit
+ */
+int drm_cursor_set_image(const lv_img_dsc_t * img, lv_coord_t hot_x, lv_coord_t hot_y);
+
+/**
+ * Move the cursor plane, a property update with the next commit
+ * @param x pointer x in LVGL coordinates
+ * @param y pointer y in LVGL coordinates
+ */
+void drm_cursor_move(lv_coord_t x, lv_coord_t y);
+
+/**
+ * Use an overlay plane for a second, transparent LVGL display on top (e.g. for
+ * popups) which is blended by the hardware. Needs LV_COLOR_DEPTH 32 and
+ * LV_COLOR_SCREEN_TRANSP, register drm_overlay_flush() as its flush_cb.
+ * @param disp_buf the overlay display's buffer to initialize
+ * @return 0 on success, -1 if there is no usable overlay plane
+ */
+int drm_overlay_disp_buf_init(lv_disp_buf_t * disp_buf);
+void drm_overlay_flush(lv_disp_drv_t * drv, const lv_area_t * area, lv_color_t * color_p);
+
 
 /**********************
  *      MACROS
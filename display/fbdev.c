@@ -6,6 +6,9 @@
 /*********************
  *      INCLUDES
  *********************/
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* needed for memfd_create() */
+#endif
 #include "fbdev.h"
 #if USE_FBDEV || USE_BSD_FBDEV
 
@@ -26,6 +29,8 @@
 #include <linux/fb.h>
 #endif /* USE_BSD_FBDEV */
 
+#include "pixconv.h"
+
 /*********************
  *      DEFINES
  *********************/
@@ -33,9 +38,74 @@
 #define FBDEV_PATH "/dev/fb0"
 #endif
 
+#ifndef FBDEV_DOUBLE_BUFFER
+#define FBDEV_DOUBLE_BUFFER 0
+#endif
+
+#ifndef FBDEV_DIRECT_RENDER
+#define FBDEV_DIRECT_RENDER 0
+#endif
+
+/*Both modes need two pages and panning which is only supported on Linux*/
+#define FBDEV_PAGE_FLIP ((FBDEV_DOUBLE_BUFFER || FBDEV_DIRECT_RENDER) && !USE_BSD_FBDEV)
+
+#ifndef FBDEV_PALETTE
+#define FBDEV_PALETTE 0
+#endif
+
+#ifndef FBDEV_MATCH_DEPTH
+#define FBDEV_MATCH_DEPTH 0
+#endif
+
+/*Entries of the 8 bpp look-up table: indexed by the raw color for 8/16 bit, by RGB565 for 32 bit*/
+#if LV_COLOR_DEPTH == 8
+#define FBDEV_LUT_SIZE 256
+#else
+#define FBDEV_LUT_SIZE 65536
+#endif
+
+/*Bits of red, green and blue in a look-up table index and
+ *bits of a channel selecting the box the table is built in (see `fbdev_palette_lut`)*/
+#if LV_COLOR_DEPTH == 8
+#define FBDEV_LUT_R_BITS 3
+#define FBDEV_LUT_G_BITS 3
+#define FBDEV_LUT_B_BITS 2
+#define FBDEV_LUT_BOX_BITS 0
+#else
+#define FBDEV_LUT_R_BITS 5
+#define FBDEV_LUT_G_BITS 6
+#define FBDEV_LUT_B_BITS 5
+#define FBDEV_LUT_BOX_BITS 3
+#endif
+
+/*Max. number of areas remembered per frame to sync the pages. More areas sync the whole page.*/
+#define FBDEV_DIRTY_MAX 32
+
 /**********************
  *      TYPEDEFS
  **********************/
+/**
+ * Write a row of LVGL pixels in the format of the device
+ * @param dev the device
+ * @param line first byte of the framebuffer line
+ * @param x index of the first pixel in the line
+ * @param src the pixels
+ * @param px number of pixels
+ */
+typedef void (*fbdev_put_row_t)(const fbdev_t* dev, uint8_t* line, uint32_t x, const lv_color_t* src, uint32_t px);
+
+/*State of drawing a splash screen*/
+typedef struct
+{
+    fbdev_t* dev;
+    lv_color_t* bg;  /*Background pixels, as wide as the screen and the logo*/
+    lv_color_t* fg;  /*Foreground pixels, as wide as the logo*/
+    lv_color_t* row; /*The logo line being drawn*/
+    int32_t x;       /*Position of the logo, negative if larger than the screen*/
+    int32_t y;
+    size_t w;
+    size_t h;
+} fbdev_splash_t;
 
 /**********************
  *      STRUCTURES
@@ -56,310 +126,1279 @@ struct bsd_fb_fix_info
     long int smem_len;
 };
 
+struct _fbdev_t
+{
+#if USE_BSD_FBDEV
+    struct bsd_fb_var_info vinfo;
+    struct bsd_fb_fix_info finfo;
+#else
+    struct fb_var_screeninfo vinfo;
+    struct fb_fix_screeninfo finfo;
+#endif /* USE_BSD_FBDEV */
+    char* fbp;
+    long int screensize;
+    int fbfd;
+    bool is_mem; /*A regular file or memfd instead of a framebuffer device*/
+    uint32_t draw_yoffset; /*First line of the page LVGL's output goes to*/
+
+    lv_disp_buf_t disp_buf;
+    lv_color_t* draw_buf; /*Allocated draw buffer or NULL in direct mode*/
+    lv_disp_t* disp;
+    uint8_t* lut8; /*Color to palette index for 8 bpp, NULL: RGB332 without look-up*/
+    fbdev_put_row_t put_row; /*Chosen once for the format of the device, NULL if not supported*/
+
+#if !USE_BSD_FBDEV
+    struct fb_var_screeninfo orig_vinfo; /*Mode to restore on delete*/
+    bool mode_changed;
+#endif
+
+#if FBDEV_PALETTE && !USE_BSD_FBDEV
+    struct fb_cmap orig_cmap; /*Colormap to restore if an RGB332 one was installed*/
+    uint16_t orig_cmap_data[3 * 256];
+    bool cmap_installed;
+#endif
+
+#if FBDEV_PAGE_FLIP
+    bool dbuf_active;
+    uint32_t dbuf_page; /*The page currently on screen*/
+    lv_area_t dirty_areas[FBDEV_DIRTY_MAX];
+    uint32_t dirty_cnt;
+    bool dirty_full;
+    bool direct_active; /*LVGL renders into the mapped pages*/
+    uint8_t* shadow; /*Cached copy of the rendered page, the pages are synced from it. NULL if not double buffered.*/
+#endif
+
+    struct _fbdev_t* next;
+};
+
 /**********************
  *  STATIC PROTOTYPES
  **********************/
+static fbdev_t* fbdev_find(lv_disp_drv_t* drv);
+static int fbdev_get_info(fbdev_t* dev);
+static fbdev_t* fbdev_setup(fbdev_t* dev, const char* name);
+#if FBDEV_MATCH_DEPTH && !USE_BSD_FBDEV
+static void fbdev_match_depth(fbdev_t* dev);
+#endif
+static void fbdev_select_format(fbdev_t* dev);
+static void fbdev_row_copy(const fbdev_t* dev, uint8_t* line, uint32_t x, const lv_color_t* src, uint32_t px);
+#if FBDEV_PALETTE && !USE_BSD_FBDEV && LV_COLOR_DEPTH > 1
+static void fbdev_palette_setup(fbdev_t* dev);
+#endif
+#if FBDEV_PALETTE == 2 && !USE_BSD_FBDEV && LV_COLOR_DEPTH > 1
+static void fbdev_palette_lut(uint8_t* lut, const uint8_t* r, const uint8_t* g, const uint8_t* b);
+#endif
+static void fbdev_frame_done(fbdev_t* dev, lv_disp_drv_t* drv, int32_t x1, int32_t y1, int32_t x2, int32_t y2);
+static int fbdev_splash_begin(fbdev_splash_t* splash, fbdev_t* dev, size_t w, size_t h, lv_color_t fg,
+                              lv_color_t bg);
+static void fbdev_splash_bits(fbdev_splash_t* splash, const uint8_t* bits);
+static void fbdev_splash_row(fbdev_splash_t* splash, size_t j);
+static void fbdev_splash_end(fbdev_splash_t* splash);
+#if LV_COLOR_DEPTH == 1
+static void fbdev_blit_1bpp(uint8_t* row, uint32_t bit, const lv_color_t* src, uint32_t px);
+#endif
+#if FBDEV_PAGE_FLIP
+static void fbdev_dbuf_setup(fbdev_t* dev);
+static void fbdev_dbuf_flip(fbdev_t* dev);
+static void fbdev_copy_area(fbdev_t* dev, uint32_t dst_yoffset, const lv_area_t* area);
+static void fbdev_direct_flip(fbdev_t* dev, const lv_color_t* color_p);
+#endif
 
 /**********************
  *  STATIC VARIABLES
  **********************/
-#if USE_BSD_FBDEV
-static struct bsd_fb_var_info vinfo;
-static struct bsd_fb_fix_info finfo;
-#else
-static struct fb_var_screeninfo vinfo;
-static struct fb_fix_screeninfo finfo;
-#endif /* USE_BSD_FBDEV */
-static char* fbp           = 0;
-static long int screensize = 0;
-static int fbfd            = 0;
+static fbdev_t* dev_def  = NULL; /*The device of `fbdev_init`*/
+static fbdev_t* dev_list = NULL; /*All open devices*/
 
 /**********************
  *      MACROS
  **********************/
 
+/**
+ * Get the look-up table index of a color
+ * @param c an LVGL color
+ * @return index in `lut8`
+ */
+static inline uint32_t fbdev_lut_index(lv_color_t c)
+{
+#if LV_COLOR_DEPTH == 32
+    return ((c.full >> 8) & 0xF800) | ((c.full >> 5) & 0x07E0) | ((c.full >> 3) & 0x001F);
+#else
+    return c.full;
+#endif
+}
+
+/**
+ * Convert a row of pixels to palette indices
+ * @param dst destination in the framebuffer
+ * @param src the pixels
+ * @param px number of pixels
+ * @param lut the look-up table of the device
+ */
+static inline void fbdev_lut_row(uint8_t* dst, const lv_color_t* src, uint32_t px, const uint8_t* lut)
+{
+    uint32_t i = 0;
+    for(; i + 4 <= px; i += 4) {
+        dst[i]     = lut[fbdev_lut_index(src[i])];
+        dst[i + 1] = lut[fbdev_lut_index(src[i + 1])];
+        dst[i + 2] = lut[fbdev_lut_index(src[i + 2])];
+        dst[i + 3] = lut[fbdev_lut_index(src[i + 3])];
+    }
+    for(; i < px; i++) dst[i] = lut[fbdev_lut_index(src[i])];
+}
+
 /**********************
  *   GLOBAL FUNCTIONS
  **********************/
 
-void fbdev_init(const char* fbdev_path)
+/**
+ * Open a framebuffer device and register it as a new display
+ * @param fbdev_path path of the device, NULL for FBDEV_PATH
+ * @return the device or NULL on error
+ */
+fbdev_t* fbdev_create(const char* fbdev_path)
 {
     if(fbdev_path == NULL) {
         fbdev_path = FBDEV_PATH;
     }
+
+    fbdev_t* dev = calloc(1, sizeof(fbdev_t));
+    if(dev == NULL) {
+        perror("Error: cannot allocate framebuffer device");
+        return NULL;
+    }
+
     // Open the file for reading and writing
-    fbfd = open(fbdev_path, O_RDWR);
-    if(fbfd == -1) {
+    dev->fbfd = open(fbdev_path, O_RDWR);
+    if(dev->fbfd == -1) {
         perror("Error: cannot open framebuffer device");
+        free(dev);
+        return NULL;
+    }
+
+    if(fbdev_get_info(dev) != 0) {
+        close(dev->fbfd);
+        free(dev);
+        return NULL;
+    }
+
+#if !USE_BSD_FBDEV
+    dev->orig_vinfo = dev->vinfo;
+#if FBDEV_MATCH_DEPTH
+    fbdev_match_depth(dev);
+#endif
+#endif
+
+#if FBDEV_PAGE_FLIP
+    fbdev_dbuf_setup(dev);
+#endif
+
+    return fbdev_setup(dev, fbdev_path);
+}
+
+/**
+ * Use a regular file or an anonymous memory file as framebuffer with the given geometry.
+ * Useful to run and benchmark the flush code without a framebuffer device.
+ * @param path path of the file (created and resized if needed), NULL for an anonymous memfd
+ * @param geom the geometry to use. `line_length` 0 means packed lines.
+ * @return the device or NULL on error
+ */
+fbdev_t* fbdev_create_mem(const char* path, const fbdev_geometry_t* geom)
+{
+    if(geom == NULL || geom->xres == 0 || geom->yres == 0 || geom->bits_per_pixel == 0) {
+        printf("fbdev: invalid geometry\n");
+        return NULL;
+    }
+
+    fbdev_t* dev = calloc(1, sizeof(fbdev_t));
+    if(dev == NULL) {
+        perror("Error: cannot allocate framebuffer device");
+        return NULL;
+    }
+
+    dev->is_mem = true;
+    if(path) {
+        dev->fbfd = open(path, O_RDWR | O_CREAT, 0644);
+    } else {
+#ifdef MFD_CLOEXEC
+        dev->fbfd = memfd_create("fbdev", MFD_CLOEXEC);
+#else
+        char tmpl[] = "/tmp/fbdev-XXXXXX";
+        dev->fbfd   = mkstemp(tmpl);
+        if(dev->fbfd != -1) unlink(tmpl);
+#endif
+        path = "memfd";
+    }
+    if(dev->fbfd == -1) {
+        perror("Error: cannot open framebuffer file");
+        free(dev);
+        return NULL;
+    }
+
+    dev->vinfo.xres           = geom->xres;
+    dev->vinfo.yres           = geom->yres;
+    dev->vinfo.xoffset        = geom->xoffset;
+    dev->vinfo.yoffset        = geom->yoffset;
+    dev->vinfo.bits_per_pixel = geom->bits_per_pixel;
+    dev->finfo.line_length    = geom->line_length;
+    if(dev->finfo.line_length == 0) {
+        dev->finfo.line_length = ((geom->xres + geom->xoffset) * geom->bits_per_pixel + 7) / 8;
+    }
+    dev->finfo.smem_len = dev->finfo.line_length * (geom->yres + geom->yoffset);
+#if !USE_BSD_FBDEV
+    dev->vinfo.xres_virtual = geom->xres + geom->xoffset;
+    dev->vinfo.yres_virtual = geom->yres + geom->yoffset;
+#endif
+
+    if(ftruncate(dev->fbfd, dev->finfo.smem_len) == -1) {
+        perror("Error: cannot resize framebuffer file");
+        close(dev->fbfd);
+        free(dev);
+        return NULL;
+    }
+
+    return fbdev_setup(dev, path);
+}
+
+/**
+ * Remove the display of a device, unmap and close it
+ * @param dev the device from `fbdev_create`
+ */
+void fbdev_delete(fbdev_t* dev)
+{
+    fbdev_t** p;
+
+    if(dev == NULL) return;
+
+    for(p = &dev_list; *p != NULL; p = &(*p)->next) {
+        if(*p == dev) {
+            *p = dev->next;
+            break;
+        }
+    }
+    if(dev_def == dev) dev_def = NULL;
+
+    if(dev->disp) lv_disp_remove(dev->disp);
+
+#if !USE_BSD_FBDEV
+    /*Give back the original depth, virtual resolution and panning*/
+    if(dev->mode_changed) {
+        if(ioctl(dev->fbfd, FBIOPUT_VSCREENINFO, &dev->orig_vinfo) == -1) {
+            perror("Error restoring variable information");
+        }
+    }
+#endif
+
+#if FBDEV_PALETTE && !USE_BSD_FBDEV
+    if(dev->cmap_installed) {
+        if(ioctl(dev->fbfd, FBIOPUTCMAP, &dev->orig_cmap) == -1) {
+            perror("Error restoring the colormap");
+        }
+    }
+#endif
+
+    if(dev->fbp) munmap(dev->fbp, dev->screensize);
+    close(dev->fbfd);
+    free(dev->lut8);
+    free(dev->draw_buf);
+#if FBDEV_PAGE_FLIP
+    free(dev->shadow);
+#endif
+    free(dev);
+}
+
+/**
+ * Get the LVGL display of a device
+ * @param dev the device from `fbdev_create`
+ * @return the display
+ */
+lv_disp_t* fbdev_get_disp(const fbdev_t* dev)
+{
+    return dev ? dev->disp : NULL;
+}
+
+void fbdev_init(const char* fbdev_path)
+{
+    dev_def = fbdev_create(fbdev_path);
+}
+
+void fbdev_exit(void)
+{
+    fbdev_delete(dev_def);
+}
+
+/**
+ * Flush a buffer to the marked area
+ * @param drv pointer to driver where this function belongs
+ * @param area an area where to copy `color_p`
+ * @param color_p an array of pixel to copy to the `area` part of the screen
+ */
+void fbdev_flush(lv_disp_drv_t* drv, const lv_area_t* area, lv_color_t* color_p)
+{
+    fbdev_t* dev = fbdev_find(drv);
+
+#if FBDEV_PAGE_FLIP
+    /*The frame is already in the framebuffer, only show it*/
+    if(dev && dev->direct_active) {
+        fbdev_direct_flip(dev, color_p);
+        lv_disp_flush_ready(drv);
         return;
     }
+#endif
+
+    if(dev == NULL || dev->fbp == NULL || area->x2 < 0 || area->y2 < 0 ||
+       area->x1 > (int32_t)dev->vinfo.xres - 1 || area->y1 > (int32_t)dev->vinfo.yres - 1) {
+        fbdev_frame_done(dev, drv, 0, 0, -1, -1);
+        return;
+    }
+
+    /*Truncate the area to the screen*/
+    int32_t act_x1 = area->x1 < 0 ? 0 : area->x1;
+    int32_t act_y1 = area->y1 < 0 ? 0 : area->y1;
+    int32_t act_x2 = area->x2 > (int32_t)dev->vinfo.xres - 1 ? (int32_t)dev->vinfo.xres - 1 : area->x2;
+    int32_t act_y2 = area->y2 > (int32_t)dev->vinfo.yres - 1 ? (int32_t)dev->vinfo.yres - 1 : area->y2;
+
+    lv_coord_t w     = (act_x2 - act_x1 + 1);
+    lv_coord_t src_w = lv_area_get_width(area);
+
+    uint8_t* fbp8         = (uint8_t*)dev->fbp;
+    uint32_t xoffset      = dev->vinfo.xoffset;
+    uint32_t draw_yoffset = dev->draw_yoffset;
+    uint32_t line_length  = dev->finfo.line_length;
+    int32_t y;
+
+    /*Skip the clipped part of the source*/
+    color_p += (act_y1 - area->y1) * src_w + (act_x1 - area->x1);
+
+#if FBDEV_PAGE_FLIP
+    /*Convert into the shadow and stream the area to the hidden page from there*/
+    if(dev->put_row && dev->shadow) {
+        lv_area_t act;
+        act.x1 = act_x1;
+        act.y1 = act_y1;
+        act.x2 = act_x2;
+        act.y2 = act_y2;
+        for(y = act_y1; y <= act_y2; y++) {
+            dev->put_row(dev, &dev->shadow[y * line_length], act_x1 + xoffset, color_p, w);
+            color_p += src_w;
+        }
+        fbdev_copy_area(dev, draw_yoffset, &act);
+    } else
+#endif
+    if(dev->put_row) {
+        for(y = act_y1; y <= act_y2; y++) {
+            dev->put_row(dev, &fbp8[(y + draw_yoffset) * line_length], act_x1 + xoffset, color_p, w);
+            color_p += src_w;
+        }
+    }
+
+    // May be some direct update command is required
+    // ret = ioctl(state->fd, FBIO_UPDATE, (unsigned long)((uintptr_t)rect));
+
+    fbdev_frame_done(dev, drv, act_x1, act_y1, act_x2, act_y2);
+}
+
+/**
+ * Clear the screen to `bgColor` and draw a 1 bpp logo in the middle of it with `fgColor`
+ * @param logoImage the logo, `(logoWidth + 7) / 8` bytes per line, the first pixel in bit 0
+ * @param logoWidth width of the logo
+ * @param logoHeight height of the logo
+ * @param fgColor color of the set bits
+ * @param bgColor color of the screen and the cleared bits
+ */
+void fbdev_splashscreen(const uint8_t* logoImage, size_t logoWidth, size_t logoHeight, lv_color_t fgColor,
+                        lv_color_t bgColor)
+{
+    fbdev_splash_t splash;
+    size_t byteWidth = (logoWidth + 7) / 8;
+    size_t j;
+
+    if(fbdev_splash_begin(&splash, dev_def, logoWidth, logoHeight, fgColor, bgColor) != 0) return;
+
+    for(j = 0; j < logoHeight; j++) {
+        fbdev_splash_bits(&splash, &logoImage[j * byteWidth]);
+        fbdev_splash_row(&splash, j);
+    }
+
+    fbdev_splash_end(&splash);
+}
+
+/**
+ * Like `fbdev_splashscreen` but with a run-length encoded logo which is decoded straight to the screen.
+ * The pixels of the logo are stored in line order as alternating runs of background and foreground
+ * pixels, starting with background. Each run length is an unsigned LEB128 number (7 bits per byte,
+ * least significant group first, bit 7 set if more bytes follow). Runs can span lines, a 0 length
+ * run only switches the color. Missing pixels at the end stay background.
+ * @param rle the encoded logo
+ * @param rleSize size of `rle` in bytes
+ * @param logoWidth width of the logo
+ * @param logoHeight height of the logo
+ * @param fgColor color of the foreground runs
+ * @param bgColor color of the screen and the background runs
+ */
+void fbdev_splashscreen_rle(const uint8_t* rle, size_t rleSize, size_t logoWidth, size_t logoHeight,
+                            lv_color_t fgColor, lv_color_t bgColor)
+{
+    fbdev_splash_t splash;
+    pixconv_rle_t rle_dec;
+    pixconv_rle_span_t span;
+
+    if(fbdev_splash_begin(&splash, dev_def, logoWidth, logoHeight, fgColor, bgColor) != 0) return;
+
+    pixconv_rle_init(&rle_dec, rle, rleSize, logoWidth, logoHeight);
+    while(pixconv_rle_next(&rle_dec, &span)) {
+        memcpy(&splash.row[span.x], span.fg ? splash.fg : splash.bg, span.len * sizeof(lv_color_t));
+        if(span.x + span.len == logoWidth) fbdev_splash_row(&splash, span.y);
+    }
+
+    fbdev_splash_end(&splash);
+}
 
+void fbdev_get_sizes(uint32_t* width, uint32_t* height)
+{
+    if(width) *width = dev_def ? dev_def->vinfo.xres : 0;
+
+    if(height) *height = dev_def ? dev_def->vinfo.yres : 0;
+}
+
+/**********************
+ *   STATIC FUNCTIONS
+ **********************/
+
+/**
+ * Find the device a display driver belongs to
+ * @param drv pointer to the registered driver (as passed to the flush callback)
+ * @return the device, the one of `fbdev_init` if not found
+ */
+static fbdev_t* fbdev_find(lv_disp_drv_t* drv)
+{
+    fbdev_t* dev;
+    for(dev = dev_list; dev != NULL; dev = dev->next) {
+        if(dev->disp && &dev->disp->driver == drv) return dev;
+    }
+
+    return dev_def;
+}
+
+/**
+ * Read the screen geometry of an open device
+ * @param dev the device
+ * @return 0 on success
+ */
+static int fbdev_get_info(fbdev_t* dev)
+{
 #if USE_BSD_FBDEV
     struct fbtype fb;
     unsigned line_length;
 
     // Get fb type
-    if(ioctl(fbfd, FBIOGTYPE, &fb) != 0) {
+    if(ioctl(dev->fbfd, FBIOGTYPE, &fb) != 0) {
         perror("ioctl(FBIOGTYPE)");
-        return;
+        return -1;
     }
 
     // Get screen width
-    if(ioctl(fbfd, FBIO_GETLINEWIDTH, &line_length) != 0) {
+    if(ioctl(dev->fbfd, FBIO_GETLINEWIDTH, &line_length) != 0) {
         perror("ioctl(FBIO_GETLINEWIDTH)");
-        return;
+        return -1;
     }
 
-    vinfo.xres           = (unsigned)fb.fb_width;
-    vinfo.yres           = (unsigned)fb.fb_height;
-    vinfo.bits_per_pixel = fb.fb_depth;
-    vinfo.xoffset        = 0;
-    vinfo.yoffset        = 0;
-    finfo.line_length    = line_length;
-    finfo.smem_len       = finfo.line_length * vinfo.yres;
+    dev->vinfo.xres           = (unsigned)fb.fb_width;
+    dev->vinfo.yres           = (unsigned)fb.fb_height;
+    dev->vinfo.bits_per_pixel = fb.fb_depth;
+    dev->vinfo.xoffset        = 0;
+    dev->vinfo.yoffset        = 0;
+    dev->finfo.line_length    = line_length;
+    dev->finfo.smem_len       = dev->finfo.line_length * dev->vinfo.yres;
 #else  /* USE_BSD_FBDEV */
 
     // Get fixed screen information
-    if(ioctl(fbfd, FBIOGET_FSCREENINFO, &finfo) == -1) {
+    if(ioctl(dev->fbfd, FBIOGET_FSCREENINFO, &dev->finfo) == -1) {
         perror("Error reading fixed information");
-        return;
+        return -1;
     }
 
     // Get variable screen information
-    if(ioctl(fbfd, FBIOGET_VSCREENINFO, &vinfo) == -1) {
+    if(ioctl(dev->fbfd, FBIOGET_VSCREENINFO, &dev->vinfo) == -1) {
         perror("Error reading variable information");
-        return;
+        return -1;
     }
 #endif /* USE_BSD_FBDEV */
 
-    printf("%dx%d, %dbpp\n", vinfo.xres, vinfo.yres, vinfo.bits_per_pixel);
+    return 0;
+}
+
+/**
+ * Map a device whose geometry is known, allocate the draw buffer and register the display
+ * @param dev the device
+ * @param name name to print
+ * @return `dev` or NULL on error (`dev` is freed then)
+ */
+static fbdev_t* fbdev_setup(fbdev_t* dev, const char* name)
+{
+    printf("%s: %dx%d, %dbpp\n", name, dev->vinfo.xres, dev->vinfo.yres, dev->vinfo.bits_per_pixel);
+
+    pixconv_init();
 
     // Figure out the size of the screen in bytes
-    screensize = finfo.smem_len; // finfo.line_length * vinfo.yres;
+    dev->screensize = dev->finfo.smem_len; // finfo.line_length * vinfo.yres;
 
     // Map the device to memory
-    fbp = (char*)mmap(0, screensize, PROT_READ | PROT_WRITE, MAP_SHARED, fbfd, 0);
-    if((intptr_t)fbp == -1) {
+    dev->fbp = (char*)mmap(0, dev->screensize, PROT_READ | PROT_WRITE, MAP_SHARED, dev->fbfd, 0);
+    if((intptr_t)dev->fbp == -1) {
         perror("Error: failed to map framebuffer device to memory");
-        return;
+        dev->fbp = NULL;
+        fbdev_delete(dev);
+        return NULL;
+    }
+    memset(dev->fbp, 0, dev->screensize);
+
+#if FBDEV_PALETTE && !USE_BSD_FBDEV && LV_COLOR_DEPTH > 1
+    if(dev->vinfo.bits_per_pixel == 8 && !dev->is_mem) fbdev_palette_setup(dev);
+#endif
+
+    fbdev_select_format(dev);
+
+    dev->draw_yoffset = dev->vinfo.yoffset;
+#if FBDEV_PAGE_FLIP
+    /*Render into the hidden page*/
+    if(dev->dbuf_active) dev->draw_yoffset = (1 - dev->dbuf_page) * dev->vinfo.yres;
+#endif
+
+#if FBDEV_DIRECT_RENDER && FBDEV_PAGE_FLIP && !LV_COLOR_16_SWAP
+    /*LVGL can draw into the pages if they look exactly like a screen sized `lv_color_t` array*/
+    if(dev->dbuf_active && dev->put_row == fbdev_row_copy && dev->vinfo.xoffset == 0 &&
+       dev->finfo.line_length == dev->vinfo.xres * sizeof(lv_color_t)) {
+        /*Start on the hidden page. With two screen sized buffers LVGL keeps the pages in sync itself.*/
+        char* page0 = dev->fbp;
+        char* page1 = dev->fbp + dev->vinfo.yres * dev->finfo.line_length;
+        lv_disp_buf_init(&dev->disp_buf, page1, page0, dev->vinfo.xres * dev->vinfo.yres);
+        dev->direct_active = true;
+        printf("fbdev: direct rendering into the framebuffer\n");
+    } else
+#endif
+    {
+#if FBDEV_DIRECT_RENDER
+        printf("fbdev: direct rendering is not possible with this framebuffer, using a draw buffer\n");
+#endif
+        dev->draw_buf = (lv_color_t*)malloc(dev->vinfo.xres * dev->vinfo.yres * sizeof(lv_color_t));
+        if(dev->draw_buf == NULL) {
+            perror("Error: cannot allocate the draw buffer");
+            fbdev_delete(dev);
+            return NULL;
+        }
+        lv_disp_buf_init(&dev->disp_buf, dev->draw_buf, NULL, dev->vinfo.xres * dev->vinfo.yres);
+
+#if FBDEV_PAGE_FLIP
+        /*The framebuffer is uncached or write-combined: never read it back to sync the pages*/
+        if(dev->dbuf_active) {
+            dev->shadow = calloc(1, dev->finfo.line_length * dev->vinfo.yres);
+            if(dev->shadow == NULL) {
+                perror("fbdev: cannot allocate the shadow page, double buffering disabled");
+                dev->draw_yoffset = dev->vinfo.yoffset;
+                dev->dbuf_active  = false;
+            }
+        }
+#endif
     }
-    memset(fbp, 0, screensize);
 
-    static lv_disp_buf_t disp_buf;
-    lv_disp_buf_init(&disp_buf, (lv_color_t*)malloc(vinfo.xres * vinfo.yres * sizeof(lv_color_t)), NULL,
-                     vinfo.xres * vinfo.yres);
+    /*Add to the list before registering so the flush callback can find the device*/
+    dev->next = dev_list;
+    dev_list  = dev;
 
     lv_disp_drv_t disp_drv;
     lv_disp_drv_init(&disp_drv);
-    disp_drv.hor_res  = vinfo.xres;
-    disp_drv.ver_res  = vinfo.yres;
+    disp_drv.hor_res  = dev->vinfo.xres;
+    disp_drv.ver_res  = dev->vinfo.yres;
     disp_drv.flush_cb = fbdev_flush;
-    disp_drv.buffer   = &disp_buf;
-    lv_disp_drv_register(&disp_drv);
+    disp_drv.buffer   = &dev->disp_buf;
+    dev->disp         = lv_disp_drv_register(&disp_drv);
+
+    return dev;
 }
 
-void fbdev_exit(void)
+#if FBDEV_MATCH_DEPTH && !USE_BSD_FBDEV
+/**
+ * Ask the driver for LV_COLOR_DEPTH bits per pixel so that the flush needs no conversion.
+ * Keeps the current mode if the driver refuses it.
+ * @param dev the device
+ */
+static void fbdev_match_depth(fbdev_t* dev)
 {
-    close(fbfd);
+    struct fb_var_screeninfo req;
+
+    if(dev->vinfo.bits_per_pixel == LV_COLOR_DEPTH) return;
+
+    req                = dev->vinfo;
+    req.bits_per_pixel = LV_COLOR_DEPTH;
+    if(ioctl(dev->fbfd, FBIOPUT_VSCREENINFO, &req) == -1 ||
+       ioctl(dev->fbfd, FBIOGET_VSCREENINFO, &dev->vinfo) == -1 ||
+       ioctl(dev->fbfd, FBIOGET_FSCREENINFO, &dev->finfo) == -1) {
+        perror("fbdev: cannot change the color depth, converting instead");
+        ioctl(dev->fbfd, FBIOGET_VSCREENINFO, &dev->vinfo);
+        ioctl(dev->fbfd, FBIOGET_FSCREENINFO, &dev->finfo);
+        return;
+    }
+
+    dev->mode_changed = true;
+    printf("fbdev: color depth changed from %d to %d bpp\n", dev->orig_vinfo.bits_per_pixel,
+           dev->vinfo.bits_per_pixel);
 }
+#endif /*FBDEV_MATCH_DEPTH && !USE_BSD_FBDEV*/
+
+static void fbdev_row_copy(const fbdev_t* dev, uint8_t* line, uint32_t x, const lv_color_t* src, uint32_t px)
+{
+    pixconv_copy_stream(line + x * sizeof(lv_color_t), src, px * sizeof(lv_color_t));
+}
+
+static void fbdev_row_xrgb8888(const fbdev_t* dev, uint8_t* line, uint32_t x, const lv_color_t* src, uint32_t px)
+{
+    pixconv_lv_to_xrgb8888((uint32_t*)(line + x * 4), src, px);
+}
+
+static void fbdev_row_xbgr8888(const fbdev_t* dev, uint8_t* line, uint32_t x, const lv_color_t* src, uint32_t px)
+{
+    pixconv_lv_to_xbgr8888((uint32_t*)(line + x * 4), src, px);
+}
+
+static void fbdev_row_rgb888(const fbdev_t* dev, uint8_t* line, uint32_t x, const lv_color_t* src, uint32_t px)
+{
+    pixconv_lv_to_rgb888(line + x * 3, src, px);
+}
+
+static void fbdev_row_bgr888(const fbdev_t* dev, uint8_t* line, uint32_t x, const lv_color_t* src, uint32_t px)
+{
+    pixconv_lv_to_bgr888(line + x * 3, src, px);
+}
+
+static void fbdev_row_rgb565(const fbdev_t* dev, uint8_t* line, uint32_t x, const lv_color_t* src, uint32_t px)
+{
+    pixconv_lv_to_rgb565((uint16_t*)(line + x * 2), src, px);
+}
+
+static void fbdev_row_bgr565(const fbdev_t* dev, uint8_t* line, uint32_t x, const lv_color_t* src, uint32_t px)
+{
+    pixconv_lv_to_bgr565((uint16_t*)(line + x * 2), src, px);
+}
+
+static void fbdev_row_rgb332(const fbdev_t* dev, uint8_t* line, uint32_t x, const lv_color_t* src, uint32_t px)
+{
+    pixconv_lv_to_rgb332(line + x, src, px);
+}
+
+static void fbdev_row_lut(const fbdev_t* dev, uint8_t* line, uint32_t x, const lv_color_t* src, uint32_t px)
+{
+    fbdev_lut_row(line + x, src, px, dev->lut8);
+}
+
+#if LV_COLOR_DEPTH == 1
+static void fbdev_row_1bpp(const fbdev_t* dev, uint8_t* line, uint32_t x, const lv_color_t* src, uint32_t px)
+{
+    fbdev_blit_1bpp(line, x, src, px);
+}
+#endif
 
 /**
- * Flush a buffer to the marked area
- * @param drv pointer to driver where this function belongs
- * @param area an area where to copy `color_p`
- * @param color_p an array of pixel to copy to the `area` part of the screen
+ * Decode the pixel format of the device and choose the row writer for it:
+ * a plain copy if it matches `lv_color_t`, a swizzle or a conversion otherwise.
+ * @param dev the device
  */
-void fbdev_flush(lv_disp_drv_t* drv, const lv_area_t* area, lv_color_t* color_p)
+static void fbdev_select_format(fbdev_t* dev)
 {
-    if(fbp == NULL || area->x2 < 0 || area->y2 < 0 || area->x1 > (int32_t)vinfo.xres - 1 ||
-       area->y1 > (int32_t)vinfo.yres - 1) {
-        lv_disp_flush_ready(drv);
+    uint32_t bpp     = dev->vinfo.bits_per_pixel;
+    bool bgr         = false;
+    const char* name = NULL;
+
+#if !USE_BSD_FBDEV
+    /*BSD and memory backed devices don't describe the channels, RGB is assumed then*/
+    bgr = dev->vinfo.red.length != 0 && dev->vinfo.red.offset < dev->vinfo.blue.offset;
+    if(bpp == 16 && dev->vinfo.green.length != 0 && dev->vinfo.green.length != 6) {
+        printf("fbdev: %d bit green channel is not supported, the colors will be wrong\n",
+               dev->vinfo.green.length);
+    }
+#endif
+
+    dev->put_row = NULL;
+    switch(bpp) {
+        case 32:
+            name         = bgr ? "XBGR8888" : "XRGB8888";
+            dev->put_row = bgr ? fbdev_row_xbgr8888 : LV_COLOR_DEPTH == 32 ? fbdev_row_copy : fbdev_row_xrgb8888;
+            break;
+        case 24:
+            name         = bgr ? "BGR888" : "RGB888";
+            dev->put_row = bgr ? fbdev_row_bgr888 : fbdev_row_rgb888;
+            break;
+        case 16:
+            name         = bgr ? "BGR565" : "RGB565";
+            dev->put_row = bgr ? fbdev_row_bgr565
+                               : LV_COLOR_DEPTH == 16 && !LV_COLOR_16_SWAP ? fbdev_row_copy : fbdev_row_rgb565;
+            break;
+        case 8:
+            name         = dev->lut8 ? "colormap" : "RGB332";
+            dev->put_row = dev->lut8 ? fbdev_row_lut : LV_COLOR_DEPTH == 8 ? fbdev_row_copy : fbdev_row_rgb332;
+            break;
+#if LV_COLOR_DEPTH == 1
+        case 1:
+            name         = "monochrome";
+            dev->put_row = fbdev_row_1bpp;
+            break;
+#endif
+        default:
+            break;
+    }
+
+    if(dev->put_row == NULL) {
+        printf("fbdev: %d bpp is not supported with LV_COLOR_DEPTH %d\n", bpp, LV_COLOR_DEPTH);
+    } else {
+        printf("fbdev: %s%s\n", name, dev->put_row == fbdev_row_copy ? ", no conversion needed" : "");
+    }
+}
+
+#if FBDEV_PALETTE && !USE_BSD_FBDEV && LV_COLOR_DEPTH > 1
+/**
+ * Install an RGB332 colormap (FBDEV_PALETTE 1) or build a look-up table
+ * to the nearest entries of the device's colormap (FBDEV_PALETTE 2).
+ * Without a usable colormap RGB332 is assumed as before.
+ * @param dev an 8 bpp device
+ */
+static void fbdev_palette_setup(fbdev_t* dev)
+{
+    uint32_t i;
+
+    if(dev->finfo.visual != FB_VISUAL_PSEUDOCOLOR) return;
+
+    dev->orig_cmap.start  = 0;
+    dev->orig_cmap.len    = 256;
+    dev->orig_cmap.red    = &dev->orig_cmap_data[0];
+    dev->orig_cmap.green  = &dev->orig_cmap_data[256];
+    dev->orig_cmap.blue   = &dev->orig_cmap_data[512];
+    dev->orig_cmap.transp = NULL;
+    if(ioctl(dev->fbfd, FBIOGETCMAP, &dev->orig_cmap) == -1) {
+        perror("fbdev: FBIOGETCMAP failed, assuming RGB332");
         return;
     }
 
-    /*Truncate the area to the screen*/
-    int32_t act_x1 = area->x1 < 0 ? 0 : area->x1;
-    int32_t act_y1 = area->y1 < 0 ? 0 : area->y1;
-    int32_t act_x2 = area->x2 > (int32_t)vinfo.xres - 1 ? (int32_t)vinfo.xres - 1 : area->x2;
-    int32_t act_y2 = area->y2 > (int32_t)vinfo.yres - 1 ? (int32_t)vinfo.yres - 1 : area->y2;
-
-    lv_coord_t w               = (act_x2 - act_x1 + 1);
-    long int location          = 0;
-    long int byte_location     = 0;
-    unsigned char bit_location = 0;
-
-    uint32_t* fbp32 = (uint32_t*)fbp;
-    uint16_t* fbp16 = (uint16_t*)fbp;
-    uint8_t* fbp8   = (uint8_t*)fbp;
-    int32_t x, y;
-
-    if(LV_COLOR_DEPTH == vinfo.bits_per_pixel) {
-        /*32 or 24 bit per pixel*/
-        if(vinfo.bits_per_pixel == 32 || vinfo.bits_per_pixel == 24) {
-            for(y = act_y1; y <= act_y2; y++) {
-                location = (act_x1 + vinfo.xoffset) + (y + vinfo.yoffset) * finfo.line_length / 4;
-                memcpy(&fbp32[location], (uint32_t*)color_p, (act_x2 - act_x1 + 1) * 4);
-                color_p += w;
-            }
-        }
-        /*16 bit per pixel*/
-        else if(vinfo.bits_per_pixel == 16) {
-            for(y = act_y1; y <= act_y2; y++) {
-                location = (act_x1 + vinfo.xoffset) + (y + vinfo.yoffset) * finfo.line_length / 2;
-                memcpy(&fbp16[location], (uint32_t*)color_p, (act_x2 - act_x1 + 1) * 2);
-                color_p += w;
-            }
-        }
-        /*8 bit per pixel*/
-        else if(vinfo.bits_per_pixel == 8) {
-            for(y = act_y1; y <= act_y2; y++) {
-                location = (act_x1 + vinfo.xoffset) + (y + vinfo.yoffset) * finfo.line_length;
-                memcpy(&fbp8[location], (uint32_t*)color_p, (act_x2 - act_x1 + 1));
-                color_p += w;
-            }
-        }
-        /*1 bit per pixel*/
-        else if(vinfo.bits_per_pixel == 1) {
-            for(y = act_y1; y <= act_y2; y++) {
-                for(x = act_x1; x <= act_x2; x++) {
-                    location      = (x + vinfo.xoffset) + (y + vinfo.yoffset) * vinfo.xres;
-                    byte_location = location / 8; /* find the byte we need to change */
-                    bit_location  = location % 8; /* inside the byte found, find the bit we need to change */
-                    fbp8[byte_location] &= ~(((uint8_t)(1)) << bit_location);
-                    fbp8[byte_location] |= ((uint8_t)(color_p->full)) << bit_location;
-                    color_p++;
+#if FBDEV_PALETTE == 1
+    /*rrrgggbb, expanded to 16 bit by bit replication*/
+    uint16_t r[256], g[256], b[256];
+    struct fb_cmap cmap;
+    for(i = 0; i < 256; i++) {
+        r[i] = ((i >> 5) & 0x7) * 0xFFFF / 7;
+        g[i] = ((i >> 2) & 0x7) * 0xFFFF / 7;
+        b[i] = (i & 0x3) * 0xFFFF / 3;
+    }
+    cmap.start  = 0;
+    cmap.len    = 256;
+    cmap.red    = r;
+    cmap.green  = g;
+    cmap.blue   = b;
+    cmap.transp = NULL;
+    if(ioctl(dev->fbfd, FBIOPUTCMAP, &cmap) == -1) {
+        perror("fbdev: FBIOPUTCMAP failed, assuming RGB332");
+        return;
+    }
+    dev->cmap_installed = true;
+    printf("fbdev: RGB332 colormap installed\n");
+#else
+    uint8_t r8[256], g8[256], b8[256];
+    for(i = 0; i < 256; i++) {
+        r8[i] = dev->orig_cmap.red[i] >> 8;
+        g8[i] = dev->orig_cmap.green[i] >> 8;
+        b8[i] = dev->orig_cmap.blue[i] >> 8;
+    }
+
+    dev->lut8 = malloc(FBDEV_LUT_SIZE);
+    if(dev->lut8 == NULL) {
+        perror("fbdev: cannot allocate the palette look-up table");
+        return;
+    }
+    fbdev_palette_lut(dev->lut8, r8, g8, b8);
+    printf("fbdev: using the device colormap\n");
+#endif
+}
+#endif /*FBDEV_PALETTE && !USE_BSD_FBDEV && LV_COLOR_DEPTH > 1*/
+
+#if FBDEV_PALETTE == 2 && !USE_BSD_FBDEV && LV_COLOR_DEPTH > 1
+/**
+ * Get the 8 bit value of a channel level in a look-up table index, see `fbdev_lut_index`
+ * @param v the level
+ * @param bits bits of the channel
+ * @return 0..255
+ */
+static inline int32_t fbdev_lut_level(uint32_t v, uint32_t bits)
+{
+    if(bits == 5) return (v << 3) | (v >> 2);
+    if(bits == 6) return (v << 2) | (v >> 4);
+    return v * 255 / ((1 << bits) - 1);
+}
+
+/**
+ * Fill the look-up table with the nearest colormap entries, the lowest index on a tie.
+ * The color cube is split into boxes and each box only searches the entries that can be
+ * the nearest to any color in it, like the inverse colormap of libjpeg.
+ * @param lut the table, FBDEV_LUT_SIZE entries
+ * @param r, g, b the 8 bit channels of the 256 colormap entries
+ */
+static void fbdev_palette_lut(uint8_t* lut, const uint8_t* r, const uint8_t* g, const uint8_t* b)
+{
+    const uint32_t bits[3] = {FBDEV_LUT_R_BITS, FBDEV_LUT_G_BITS, FBDEV_LUT_B_BITS};
+    uint32_t box_levels[3]; /*Levels of a channel in a box*/
+    uint32_t box[3];        /*First level of the current box*/
+    uint8_t cand[256];
+    int32_t cand_r[256], cand_g[256], cand_b[256];
+    uint32_t cand_dmin[256]; /*Distance of the candidates to the box, ascending*/
+    uint32_t c, j;
+
+    for(c = 0; c < 3; c++) box_levels[c] = 1 << (bits[c] - FBDEV_LUT_BOX_BITS);
+
+    for(box[0] = 0; box[0] < (1U << bits[0]); box[0] += box_levels[0]) {
+        for(box[1] = 0; box[1] < (1U << bits[1]); box[1] += box_levels[1]) {
+            for(box[2] = 0; box[2] < (1U << bits[2]); box[2] += box_levels[2]) {
+                int32_t lo[3], hi[3];
+                for(c = 0; c < 3; c++) {
+                    lo[c] = fbdev_lut_level(box[c], bits[c]);
+                    hi[c] = fbdev_lut_level(box[c] + box_levels[c] - 1, bits[c]);
                 }
 
-                color_p += area->x2 - act_x2;
-            }
-        } else {
-            /*Not supported bit per pixel*/
-        }
-    } else { // LV_COLOR_DEPTH != vinfo.bits_per_pixel
-        /*32 bit per pixel*/
-        if(vinfo.bits_per_pixel == 32) {
-            for(y = area->y1; y <= area->y2 && y < vinfo.yres; y++) {
-                for(x = area->x1; x <= area->x2; x++) {
-                    // UNTESTED, MIGHT NEED A BYTE SWAP
-                    fbp32[(y * vinfo.xres + x)] = lv_color_to32(*color_p);
-                    color_p++;
+                /*Every color of the box has an entry at most `minmax` away (the entry with the
+                 *nearest farthest corner), entries farther than that from the whole box can't be the nearest*/
+                uint32_t minmax = UINT32_MAX;
+                for(j = 0; j < 256; j++) {
+                    const int32_t e[3] = {r[j], g[j], b[j]};
+                    uint32_t d         = 0;
+                    for(c = 0; c < 3; c++) {
+                        int32_t dc = e[c] - lo[c] > hi[c] - e[c] ? e[c] - lo[c] : hi[c] - e[c];
+                        d += dc * dc;
+                    }
+                    if(d < minmax) minmax = d;
                 }
-            }
-        }
-        /*24 bit per pixel*/
-        else if(vinfo.bits_per_pixel == 24) {
-            for(y = area->y1; y <= area->y2 && y < vinfo.yres; y++) {
-                int32_t y_offset = (y * vinfo.xres + area->x1) * 3;
-                for(x = area->x1; x <= area->x2; x++) {
-                    uint32_t color = lv_color_to32(*color_p);
-                    color_p++;
-                    fbp8[y_offset++] = (color >> 0) & 0xFF;  // B
-                    fbp8[y_offset++] = (color >> 8) & 0xFF;  // G
-                    fbp8[y_offset++] = (color >> 16) & 0xFF; // R
+
+                uint32_t cand_cnt = 0;
+                for(j = 0; j < 256; j++) {
+                    const int32_t e[3] = {r[j], g[j], b[j]};
+                    uint32_t d         = 0;
+                    for(c = 0; c < 3; c++) {
+                        int32_t dc = e[c] < lo[c] ? lo[c] - e[c] : e[c] > hi[c] ? e[c] - hi[c] : 0;
+                        d += dc * dc;
+                    }
+                    if(d > minmax) continue;
+
+                    uint32_t k = cand_cnt++;
+                    for(; k > 0 && cand_dmin[k - 1] > d; k--) {
+                        cand[k]      = cand[k - 1];
+                        cand_r[k]    = cand_r[k - 1];
+                        cand_g[k]    = cand_g[k - 1];
+                        cand_b[k]    = cand_b[k - 1];
+                        cand_dmin[k] = cand_dmin[k - 1];
+                    }
+                    cand[k]      = j;
+                    cand_r[k]    = e[0];
+                    cand_g[k]    = e[1];
+                    cand_b[k]    = e[2];
+                    cand_dmin[k] = d;
                 }
-            }
-        }
-        /*16 bit per pixel*/
-        else if(vinfo.bits_per_pixel == 16) {
-            for(y = area->y1; y <= area->y2 && y < vinfo.yres; y++) {
-                for(x = area->x1; x <= area->x2; x++) {
-                    // UNTESTED, MIGHT NEED A BYTE SWAP
-                    fbp16[(y * vinfo.xres + x)] = lv_color_to16(*color_p);
-                    color_p++;
+
+                uint32_t lr, lg, lb;
+                for(lr = box[0]; lr < box[0] + box_levels[0]; lr++) {
+                    int32_t cr = fbdev_lut_level(lr, bits[0]);
+                    for(lg = box[1]; lg < box[1] + box_levels[1]; lg++) {
+                        int32_t cg = fbdev_lut_level(lg, bits[1]);
+                        for(lb = box[2]; lb < box[2] + box_levels[2]; lb++) {
+                            int32_t cb      = fbdev_lut_level(lb, bits[2]);
+                            uint32_t best_d = UINT32_MAX;
+                            uint32_t best   = 0;
+                            /*The remaining candidates are even farther from the whole box*/
+                            for(j = 0; j < cand_cnt && cand_dmin[j] <= best_d; j++) {
+                                int32_t dr = cr - cand_r[j];
+                                int32_t dg = cg - cand_g[j];
+                                int32_t db = cb - cand_b[j];
+                                uint32_t d = dr * dr + dg * dg + db * db;
+                                if(d < best_d || (d == best_d && cand[j] < cand[best])) {
+                                    best_d = d;
+                                    best   = j;
+                                }
+                            }
+
+                            uint32_t i = (lr << (FBDEV_LUT_G_BITS + FBDEV_LUT_B_BITS)) | (lg << FBDEV_LUT_B_BITS) | lb;
+#if LV_COLOR_DEPTH == 16 && LV_COLOR_16_SWAP
+                            i = ((i << 8) | (i >> 8)) & 0xFFFF;
+#endif
+                            lut[i] = cand[best];
+                        }
+                    }
                 }
             }
         }
-        /*8 bit per pixel*/
-        else if(vinfo.bits_per_pixel == 8) {
-            for(y = area->y1; y <= area->y2 && y < vinfo.yres; y++) {
-                int32_t y_offset = (y * vinfo.xres + x) * 3;
-                for(x = area->x1; x <= area->x2; x++) {
-                    // UNTESTED
-                    fbp8[(y * vinfo.xres + x)] = lv_color_to8(*color_p);
-                    color_p++;
-                }
+    }
+}
+#endif /*FBDEV_PALETTE == 2 && !USE_BSD_FBDEV && LV_COLOR_DEPTH > 1*/
+
+/**
+ * Finish a flush: remember the area and flip the pages after the last area of the frame
+ * @param dev the device (can be NULL)
+ * @param drv pointer to driver where this function belongs
+ * @param x1, y1, x2, y2 the area written to the framebuffer (empty if x2 < x1)
+ */
+static void fbdev_frame_done(fbdev_t* dev, lv_disp_drv_t* drv, int32_t x1, int32_t y1, int32_t x2, int32_t y2)
+{
+    /*Drain the streaming stores of this flush before the area is shown*/
+    pixconv_stream_fence();
+
+#if FBDEV_PAGE_FLIP
+    if(dev && dev->dbuf_active) {
+        if(x2 >= x1 && y2 >= y1) {
+            if(dev->dirty_cnt < FBDEV_DIRTY_MAX) {
+                lv_area_t* a = &dev->dirty_areas[dev->dirty_cnt++];
+                a->x1        = x1;
+                a->y1        = y1;
+                a->x2        = x2;
+                a->y2        = y2;
+            } else {
+                dev->dirty_full = true;
             }
+        }
+
+        if(lv_disp_flush_is_last(drv)) fbdev_dbuf_flip(dev);
+    }
+#else
+    (void)dev;
+    (void)x1;
+    (void)y1;
+    (void)x2;
+    (void)y2;
+#endif
+
+    lv_disp_flush_ready(drv);
+}
+
+/**
+ * Prepare the pixel rows of a splash screen and clear the visible page to the background.
+ * The background line is converted once and then copied to every line.
+ * @param splash state to initialize
+ * @param dev the device
+ * @param w width of the logo
+ * @param h height of the logo
+ * @param fg foreground color
+ * @param bg background color
+ * @return 0 on success
+ */
+static int fbdev_splash_begin(fbdev_splash_t* splash, fbdev_t* dev, size_t w, size_t h, lv_color_t fg,
+                              lv_color_t bg)
+{
+    uint32_t xres        = dev ? dev->vinfo.xres : 0;
+    uint32_t line_length = dev ? dev->finfo.line_length : 0;
+    size_t bg_w          = xres > w ? xres : w;
+    uint8_t* line;
+    uint8_t* fbp;
+    uint32_t y;
+
+    memset(splash, 0, sizeof(fbdev_splash_t));
+    if(dev == NULL || dev->fbp == NULL || dev->put_row == NULL) return -1;
+
+    splash->bg = malloc((bg_w + 2 * w) * sizeof(lv_color_t));
+    line       = malloc(line_length);
+    if(splash->bg == NULL || line == NULL) {
+        perror("fbdev: cannot allocate the splash screen");
+        free(splash->bg);
+        free(line);
+        return -1;
+    }
+    splash->fg  = splash->bg + bg_w;
+    splash->row = splash->fg + w;
+    splash->dev = dev;
+    splash->w   = w;
+    splash->h   = h;
+    splash->x   = ((int32_t)xres - (int32_t)w) / 2;
+    splash->y   = ((int32_t)dev->vinfo.yres - (int32_t)h) / 2;
+
+    pixconv_fill(splash->bg, &bg, sizeof(lv_color_t), bg_w);
+    pixconv_fill(splash->fg, &fg, sizeof(lv_color_t), w);
+
+    /*Convert one background line and copy it to every line of the visible page*/
+    memset(line, 0, line_length);
+    dev->put_row(dev, line, dev->vinfo.xoffset, splash->bg, xres);
+    fbp = (uint8_t*)dev->fbp + dev->vinfo.yoffset * line_length;
+    for(y = 0; y < dev->vinfo.yres; y++) {
+        pixconv_copy_stream(fbp + y * line_length, line, line_length);
+    }
+    free(line);
+
+    return 0;
+}
+
+/**
+ * Expand a line of a 1 bpp logo to the row of the splash screen, a byte at a time
+ * @param splash the splash screen
+ * @param bits the line of the logo, the first pixel in bit 0
+ */
+static void fbdev_splash_bits(fbdev_splash_t* splash, const uint8_t* bits)
+{
+    size_t i, k;
+
+    for(i = 0; i < splash->w; i += 8) {
+        uint8_t b = bits[i / 8];
+        size_t n  = splash->w - i < 8 ? splash->w - i : 8;
+        if(b == 0x00) {
+            memcpy(&splash->row[i], splash->bg, n * sizeof(lv_color_t));
+        } else if(b == 0xFF) {
+            memcpy(&splash->row[i], splash->fg, n * sizeof(lv_color_t));
         } else {
-            /*Not supported bit per pixel*/
+            for(k = 0; k < n; k++) splash->row[i + k] = (b >> k) & 1 ? splash->fg[0] : splash->bg[0];
         }
     }
+}
 
-    // May be some direct update command is required
-    // ret = ioctl(state->fd, FBIO_UPDATE, (unsigned long)((uintptr_t)rect));
+/**
+ * Write the current row of the splash screen to a line of the logo, clipped to the screen
+ * @param splash the splash screen
+ * @param j the line of the logo
+ */
+static void fbdev_splash_row(fbdev_splash_t* splash, size_t j)
+{
+    fbdev_t* dev = splash->dev;
+    int32_t y    = splash->y + (int32_t)j;
+    int32_t x    = splash->x;
+    size_t src_x = 0;
+    size_t w     = splash->w;
 
-    lv_disp_flush_ready(drv);
+    if(y < 0 || y >= (int32_t)dev->vinfo.yres) return;
+
+    if(x < 0) {
+        src_x = -x;
+        w     = dev->vinfo.xres;
+        x     = 0;
+    }
+
+    dev->put_row(dev, (uint8_t*)dev->fbp + (dev->vinfo.yoffset + y) * dev->finfo.line_length,
+                 x + dev->vinfo.xoffset, &splash->row[src_x], w);
 }
 
-static inline void fbdev_put_color(int pos, uint32_t color)
+/**
+ * Free the rows of a splash screen
+ * @param splash the splash screen
+ */
+static void fbdev_splash_end(fbdev_splash_t* splash)
 {
-    uint32_t* fbp32 = (uint32_t*)fbp;
-    uint16_t* fbp16 = (uint16_t*)fbp;
-    uint8_t* fbp8   = (uint8_t*)fbp;
-    switch(vinfo.bits_per_pixel) {
-        case 32:
-            fbp32[pos] = color;
-            break;
-        case 24:
-            fbp8[pos * 3 + 0] = (color >> 0) & 0xFF;  // B
-            fbp8[pos * 3 + 1] = (color >> 8) & 0xFF;  // G
-            fbp8[pos * 3 + 2] = (color >> 16) & 0xFF; // R
-            break;
-        case 16:
-            fbp16[pos] = color;
-            break;
-        case 8:
-            fbp8[pos] = color;
-            break;
+    pixconv_stream_fence();
+    free(splash->bg);
+}
+
+#if LV_COLOR_DEPTH == 1
+/**
+ * Pack 8 pixels to a byte, the first pixel goes to bit 0
+ * @param src 8 pixels (one byte each with the color in bit 0)
+ * @return the packed byte
+ */
+static inline uint8_t fbdev_pack8(const lv_color_t* src)
+{
+    uint64_t v;
+    memcpy(&v, src, sizeof(v));
+    /*Each 0/1 byte is multiplied to a distinct bit of the top byte without carries*/
+    return (uint8_t)(((v & 0x0101010101010101ULL) * 0x0102040810204080ULL) >> 56);
+}
+
+/**
+ * Write a row of pixels to a 1 bpp framebuffer line.
+ * The partial bytes at the edges are read-modify-written, the rest is written a word/byte at a time.
+ * @param row the first byte of the framebuffer line
+ * @param bit index of the first pixel's bit in the line
+ * @param src the pixels
+ * @param px number of pixels
+ */
+static void fbdev_blit_1bpp(uint8_t* row, uint32_t bit, const lv_color_t* src, uint32_t px)
+{
+    uint8_t* dst   = row + bit / 8;
+    uint32_t shift = bit & 7;
+    uint32_t i;
+
+    /*Head up to the next byte boundary*/
+    if(shift) {
+        uint32_t n   = px < 8 - shift ? px : 8 - shift;
+        uint8_t mask = (uint8_t)(((1U << n) - 1) << shift);
+        uint8_t v    = 0;
+        for(i = 0; i < n; i++) v |= (src[i].full & 1) << (shift + i);
+        *dst = (*dst & ~mask) | v;
+        dst++;
+        src += n;
+        px -= n;
+    }
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    /*Whole words once aligned*/
+    while(px >= 8 && ((uintptr_t)dst & 3)) {
+        *dst++ = fbdev_pack8(src);
+        src += 8;
+        px -= 8;
+    }
+    while(px >= 32) {
+        uint32_t v = (uint32_t)fbdev_pack8(src) | (uint32_t)fbdev_pack8(src + 8) << 8 |
+                     (uint32_t)fbdev_pack8(src + 16) << 16 | (uint32_t)fbdev_pack8(src + 24) << 24;
+        *(uint32_t*)dst = v;
+        dst += 4;
+        src += 32;
+        px -= 32;
+    }
+#endif
+
+    /*Whole bytes*/
+    while(px >= 8) {
+        *dst++ = fbdev_pack8(src);
+        src += 8;
+        px -= 8;
+    }
+
+    /*Tail*/
+    if(px) {
+        uint8_t mask = (uint8_t)((1U << px) - 1);
+        uint8_t v    = 0;
+        for(i = 0; i < px; i++) v |= (src[i].full & 1) << i;
+        *dst = (*dst & ~mask) | v;
     }
 }
+#endif /*LV_COLOR_DEPTH == 1*/
 
-void fbdev_splashscreen(const uint8_t* logoImage, size_t logoWidth, size_t logoHeight, lv_color_t fgColor,
-                        lv_color_t bgColor)
+#if FBDEV_PAGE_FLIP
+/**
+ * Try to get two pages of virtual resolution and check that the driver can pan between them.
+ * Leaves `dbuf_active` false if not possible.
+ * @param dev the device
+ */
+static void fbdev_dbuf_setup(fbdev_t* dev)
 {
+    if(dev->vinfo.yres_virtual < dev->vinfo.yres * 2) {
+        struct fb_var_screeninfo req = dev->vinfo;
+        req.yres_virtual             = dev->vinfo.yres * 2;
+        req.yoffset                  = 0;
+        if(ioctl(dev->fbfd, FBIOPUT_VSCREENINFO, &req) == -1 ||
+           ioctl(dev->fbfd, FBIOGET_VSCREENINFO, &dev->vinfo) == -1 ||
+           ioctl(dev->fbfd, FBIOGET_FSCREENINFO, &dev->finfo) == -1) {
+            perror("fbdev: cannot set virtual resolution, double buffering disabled");
+            ioctl(dev->fbfd, FBIOGET_VSCREENINFO, &dev->vinfo);
+            return;
+        }
+        dev->mode_changed = true;
+    }
 
-    int x = (vinfo.xres - logoWidth) / 2;
-    int y = (vinfo.yres - logoHeight) / 2;
-    int32_t i, j, byteWidth = (logoWidth + 7) / 8;
+    if(dev->vinfo.yres_virtual < dev->vinfo.yres * 2 ||
+       dev->finfo.smem_len < dev->finfo.line_length * dev->vinfo.yres * 2 || dev->finfo.ypanstep == 0 ||
+       dev->vinfo.yres % dev->finfo.ypanstep != 0) {
+        printf("fbdev: the driver cannot pan between two pages, double buffering disabled\n");
+        return;
+    }
 
-    uint32_t bgColorNum, fgColorNum;
-    switch(vinfo.bits_per_pixel) {
-        case 32:
-        case 24:
-            fgColorNum = lv_color_to32(fgColor);
-            bgColorNum = lv_color_to32(bgColor);
-            break;
-        case 16:
-            fgColorNum = lv_color_to16(fgColor);
-            bgColorNum = lv_color_to16(bgColor);
-            break;
-        case 8:
-            fgColorNum = lv_color_to8(fgColor);
-            bgColorNum = lv_color_to8(bgColor);
-            break;
+    /*Show page 0 so that rendering starts on page 1*/
+    uint32_t xoffset   = dev->vinfo.xoffset;
+    uint32_t yoffset   = dev->vinfo.yoffset;
+    dev->vinfo.xoffset = 0;
+    dev->vinfo.yoffset = 0;
+    if(ioctl(dev->fbfd, FBIOPAN_DISPLAY, &dev->vinfo) == -1) {
+        perror("fbdev: FBIOPAN_DISPLAY failed, double buffering disabled");
+        /*Still the visible offsets, single buffering draws there*/
+        dev->vinfo.xoffset = xoffset;
+        dev->vinfo.yoffset = yoffset;
+        return;
     }
 
-    for(size_t y = 0; y < vinfo.xres * vinfo.yres; y++) {
-        fbdev_put_color(y, bgColorNum);
+    dev->mode_changed = true;
+    dev->dbuf_page    = 0;
+    dev->dirty_cnt   = 0;
+    dev->dirty_full  = false;
+    dev->dbuf_active = true;
+    printf("fbdev: double buffering with %dx%d virtual resolution\n", dev->vinfo.xres_virtual,
+           dev->vinfo.yres_virtual);
+}
+
+/**
+ * Show the page rendered in this frame and bring the other page up to date
+ * @param dev the device
+ */
+static void fbdev_dbuf_flip(fbdev_t* dev)
+{
+    uint32_t back_page    = 1 - dev->dbuf_page;
+    uint32_t back_yoffset = back_page * dev->vinfo.yres;
+    uint32_t page_size    = dev->finfo.line_length * dev->vinfo.yres;
+    uint32_t i;
+
+    if(dev->dirty_cnt == 0 && !dev->dirty_full) return;
+
+    /*Not all drivers support it and some already wait in FBIOPAN_DISPLAY so ignore the result*/
+    uint32_t crtc = 0;
+    ioctl(dev->fbfd, FBIO_WAITFORVSYNC, &crtc);
+
+    dev->vinfo.yoffset = back_yoffset;
+    if(ioctl(dev->fbfd, FBIOPAN_DISPLAY, &dev->vinfo) == -1) {
+        /*Fall back to single buffering: make the rendered page visible by copying it*/
+        perror("fbdev: FBIOPAN_DISPLAY failed, double buffering disabled");
+        dev->vinfo.yoffset = dev->dbuf_page * dev->vinfo.yres;
+        pixconv_copy_stream(dev->fbp + dev->dbuf_page * page_size, dev->shadow, page_size);
+        pixconv_stream_fence();
+        free(dev->shadow);
+        dev->shadow       = NULL;
+        dev->draw_yoffset = dev->vinfo.yoffset;
+        dev->dbuf_active  = false;
+        return;
     }
 
-    for(j = 0; j < logoHeight; j++) {
-        for(i = 0; i < logoWidth; i++) {
-            if(logoImage[j * byteWidth + i / 8] & (1 << (i & 7))) {
-                fbdev_put_color((y + j) * vinfo.xres + x + i, fgColorNum);
-            }
+    /*The page now hidden misses this frame's areas*/
+    if(dev->dirty_full) {
+        pixconv_copy_stream(dev->fbp + dev->dbuf_page * page_size, dev->shadow, page_size);
+    } else {
+        for(i = 0; i < dev->dirty_cnt; i++) {
+            fbdev_copy_area(dev, dev->dbuf_page * dev->vinfo.yres, &dev->dirty_areas[i]);
         }
     }
+
+    pixconv_stream_fence();
+
+    dev->dbuf_page    = back_page;
+    dev->draw_yoffset = (1 - dev->dbuf_page) * dev->vinfo.yres;
+    dev->dirty_cnt    = 0;
+    dev->dirty_full   = false;
 }
 
-void fbdev_get_sizes(uint32_t* width, uint32_t* height)
+/**
+ * Show the page LVGL has just rendered in direct mode
+ * @param dev the device
+ * @param color_p the start of the page as passed to the flush callback
+ */
+static void fbdev_direct_flip(fbdev_t* dev, const lv_color_t* color_p)
 {
-    if(width) *width = vinfo.xres;
+    uint32_t page = (const char*)color_p == dev->fbp ? 0 : 1;
+    uint32_t crtc = 0;
 
-    if(height) *height = vinfo.yres;
+    if(page == dev->dbuf_page) return;
+
+    ioctl(dev->fbfd, FBIO_WAITFORVSYNC, &crtc);
+
+    dev->vinfo.yoffset = page * dev->vinfo.yres;
+    if(ioctl(dev->fbfd, FBIOPAN_DISPLAY, &dev->vinfo) == -1) {
+        /*LVGL copies the new areas into the visible page too, so it is still updated (with tearing)*/
+        perror("fbdev: FBIOPAN_DISPLAY failed");
+        dev->vinfo.yoffset = dev->dbuf_page * dev->vinfo.yres;
+        return;
+    }
+
+    dev->dbuf_page = page;
 }
 
-/**********************
- *   STATIC FUNCTIONS
- **********************/
+/**
+ * Copy an area from the shadow to a page of the framebuffer
+ * @param dev the device
+ * @param dst_yoffset first line of the destination page
+ * @param area the area to copy in screen coordinates
+ */
+static void fbdev_copy_area(fbdev_t* dev, uint32_t dst_yoffset, const lv_area_t* area)
+{
+    /*Round to whole bytes to handle less than 8 bpp too*/
+    long int start = ((area->x1 + dev->vinfo.xoffset) * dev->vinfo.bits_per_pixel) / 8;
+    long int end   = ((area->x2 + dev->vinfo.xoffset + 1) * dev->vinfo.bits_per_pixel + 7) / 8;
+    int32_t y;
+
+    for(y = area->y1; y <= area->y2; y++) {
+        pixconv_copy_stream(dev->fbp + (y + dst_yoffset) * dev->finfo.line_length + start,
+                            dev->shadow + y * dev->finfo.line_length + start, end - start);
+    }
+}
+#endif /*FBDEV_PAGE_FLIP*/
 
 #endif
@@ -36,15 +36,36 @@ extern "C" {
 /**********************
  *      TYPEDEFS
  **********************/
+/*An open framebuffer device with its own mapping, geometry and LVGL display*/
+typedef struct _fbdev_t fbdev_t;
+
+/*Geometry of a memory backed framebuffer (see `fbdev_create_mem`)*/
+typedef struct
+{
+    uint32_t xres;
+    uint32_t yres;
+    uint32_t bits_per_pixel;
+    uint32_t line_length; /*Bytes per line, 0: packed*/
+    uint32_t xoffset;
+    uint32_t yoffset;
+} fbdev_geometry_t;
 
 /**********************
  * GLOBAL PROTOTYPES
  **********************/
+fbdev_t* fbdev_create(const char* fbdev_path);
+fbdev_t* fbdev_create_mem(const char* path, const fbdev_geometry_t* geom);
+void fbdev_delete(fbdev_t* dev);
+lv_disp_t* fbdev_get_disp(const fbdev_t* dev);
+
+/*Single device API, works on the device opened by `fbdev_init`*/
 void fbdev_init(const char* fbdev_path);
 void fbdev_exit(void);
 void fbdev_flush(lv_disp_drv_t* drv, const lv_area_t* area, lv_color_t* color_p);
 void fbdev_splashscreen(const uint8_t* logoImage, size_t logoWidth, size_t logoHeight, lv_color_t fgColor,
                         lv_color_t bgColor);
+void fbdev_splashscreen_rle(const uint8_t* rle, size_t rleSize, size_t logoWidth, size_t logoHeight,
+                            lv_color_t fgColor, lv_color_t bgColor);
 void fbdev_get_sizes(uint32_t* width, uint32_t* height);
 
 /**********************
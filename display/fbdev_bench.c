@@ -0,0 +1,205 @@
+/**
+ * @file fbdev_bench.c
+ * Throughput of `fbdev_flush` into memory backed framebuffers of every bit depth,
+ * for a full screen, row bands, tiles and scattered small areas.
+ *
+ * Usage: fbdev_bench [width height]
+ * Built and run for each LV_COLOR_DEPTH by `make bench` in this directory,
+ * compiles to nothing in the lv_drivers.mk build.
+ */
+
+/*********************
+ *      INCLUDES
+ *********************/
+#include "fbdev.h"
+#if defined(FBDEV_BENCH) && USE_FBDEV
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/*********************
+ *      DEFINES
+ *********************/
+/*Minimal run time of a measurement*/
+#define BENCH_MIN_TIME 0.25
+
+/*Lines of a row band, LVGL's usual draw buffer is 1/10 of the screen*/
+#define ROW_BAND_DIV 10
+
+#define TILE_SIZE 64
+
+/*Size and count of the scattered areas, e.g. cursors, labels and spinners*/
+#define SMALL_SIZE 16
+#define SMALL_CNT 256
+
+/**********************
+ *      TYPEDEFS
+ **********************/
+typedef struct {
+    const char * name;
+    lv_area_t * areas;
+    uint32_t cnt;
+    uint64_t px; /*Pixels of all areas*/
+} area_mix_t;
+
+/**********************
+ *  STATIC PROTOTYPES
+ **********************/
+static double now(void);
+static void mix_add(area_mix_t * mix, lv_coord_t x1, lv_coord_t y1, lv_coord_t x2, lv_coord_t y2);
+static void mixes_create(area_mix_t * mixes, lv_coord_t w, lv_coord_t h);
+static double mix_run(lv_disp_drv_t * drv, const area_mix_t * mix, lv_color_t * color_p);
+
+/**********************
+ *   STATIC FUNCTIONS
+ **********************/
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void mix_add(area_mix_t * mix, lv_coord_t x1, lv_coord_t y1, lv_coord_t x2, lv_coord_t y2)
+{
+    lv_area_t * a = &mix->areas[mix->cnt++];
+    a->x1         = x1;
+    a->y1         = y1;
+    a->x2         = x2;
+    a->y2         = y2;
+    mix->px += (uint64_t)(x2 - x1 + 1) * (y2 - y1 + 1);
+}
+
+/*Fill the 4 area mixes for a `w` x `h` screen*/
+static void mixes_create(area_mix_t * mixes, lv_coord_t w, lv_coord_t h)
+{
+    uint32_t band  = h / ROW_BAND_DIV > 0 ? h / ROW_BAND_DIV : 1;
+    uint32_t tiles = ((w + TILE_SIZE - 1) / TILE_SIZE) * ((h + TILE_SIZE - 1) / TILE_SIZE);
+    uint32_t rnd   = 0x12345678;
+    lv_coord_t x, y;
+    uint32_t i;
+
+    mixes[0].name  = "full screen";
+    mixes[0].areas = malloc(sizeof(lv_area_t));
+    mixes[1].name  = "row bands";
+    mixes[1].areas = malloc(sizeof(lv_area_t) * ((h + band - 1) / band));
+    mixes[2].name  = "64x64 tiles";
+    mixes[2].areas = malloc(sizeof(lv_area_t) * tiles);
+    mixes[3].name  = "16x16 scattered";
+    mixes[3].areas = malloc(sizeof(lv_area_t) * SMALL_CNT);
+    for(i = 0; i < 4; i++) {
+        if(mixes[i].areas == NULL) {
+            perror("Error: cannot allocate the areas");
+            exit(EXIT_FAILURE);
+        }
+        mixes[i].cnt = 0;
+        mixes[i].px  = 0;
+    }
+
+    mix_add(&mixes[0], 0, 0, w - 1, h - 1);
+
+    for(y = 0; y < h; y += band) mix_add(&mixes[1], 0, y, w - 1, LV_MATH_MIN(y + (lv_coord_t)band, h) - 1);
+
+    for(y = 0; y < h; y += TILE_SIZE) {
+        for(x = 0; x < w; x += TILE_SIZE) {
+            mix_add(&mixes[2], x, y, LV_MATH_MIN(x + TILE_SIZE, w) - 1, LV_MATH_MIN(y + TILE_SIZE, h) - 1);
+        }
+    }
+
+    /*xorshift32: the same odd positions on every run*/
+    for(i = 0; i < SMALL_CNT; i++) {
+        rnd ^= rnd << 13;
+        rnd ^= rnd >> 17;
+        rnd ^= rnd << 5;
+        x = (lv_coord_t)(rnd % (uint32_t)LV_MATH_MAX(w - SMALL_SIZE, 1));
+        y = (lv_coord_t)((rnd >> 16) % (uint32_t)LV_MATH_MAX(h - SMALL_SIZE, 1));
+        mix_add(&mixes[3], x, y, LV_MATH_MIN(x + SMALL_SIZE, w) - 1, LV_MATH_MIN(y + SMALL_SIZE, h) - 1);
+    }
+}
+
+/**
+ * Flush the areas of a mix repeatedly
+ * @return MPix/s
+ */
+static double mix_run(lv_disp_drv_t * drv, const area_mix_t * mix, lv_color_t * color_p)
+{
+    uint64_t px = 0;
+    double start = now();
+    double t;
+    uint32_t i;
+
+    do {
+        for(i = 0; i < mix->cnt; i++) fbdev_flush(drv, &mix->areas[i], color_p);
+        px += mix->px;
+        t = now() - start;
+    } while(t < BENCH_MIN_TIME);
+
+    return px / t / 1e6;
+}
+
+/**********************
+ *   GLOBAL FUNCTIONS
+ **********************/
+
+int main(int argc, char ** argv)
+{
+#if LV_COLOR_DEPTH == 1
+    static const uint32_t bpps[] = {32, 24, 16, 8, 1};
+#else
+    static const uint32_t bpps[] = {32, 24, 16, 8};
+#endif
+    fbdev_geometry_t geom = {0};
+    area_mix_t mixes[4];
+    lv_color_t * color_p;
+    uint32_t b, m, i;
+
+    geom.xres = 1280;
+    geom.yres = 720;
+    if(argc == 3) {
+        geom.xres = strtoul(argv[1], NULL, 0);
+        geom.yres = strtoul(argv[2], NULL, 0);
+    }
+    if(geom.xres == 0 || geom.yres == 0 || argc == 2 || argc > 3) {
+        printf("usage: %s [width height]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    lv_init();
+
+    /*Any content, the flush doesn't depend on it. Every area starts at the beginning.*/
+    color_p = malloc(sizeof(lv_color_t) * geom.xres * geom.yres);
+    if(color_p == NULL) {
+        perror("Error: cannot allocate the source");
+        return EXIT_FAILURE;
+    }
+    for(i = 0; i < geom.xres * geom.yres * sizeof(lv_color_t); i++) ((uint8_t *)color_p)[i] = (uint8_t)(i * 7);
+
+    mixes_create(mixes, geom.xres, geom.yres);
+
+    printf("\nLV_COLOR_DEPTH %d, %ux%u, MPix/s\n", LV_COLOR_DEPTH, geom.xres, geom.yres);
+    printf("%-8s", "fb bpp");
+    for(m = 0; m < 4; m++) printf("%18s", mixes[m].name);
+    printf("\n");
+
+    for(b = 0; b < sizeof(bpps) / sizeof(bpps[0]); b++) {
+        geom.bits_per_pixel = bpps[b];
+        fbdev_t * dev       = fbdev_create_mem(NULL, &geom);
+        if(dev == NULL) return EXIT_FAILURE;
+
+        lv_disp_drv_t * drv = &fbdev_get_disp(dev)->driver;
+        printf("%-8u", bpps[b]);
+        for(m = 0; m < 4; m++) printf("%18.1f", mix_run(drv, &mixes[m], color_p));
+        printf("\n");
+
+        fbdev_delete(dev);
+    }
+
+    for(m = 0; m < 4; m++) free(mixes[m].areas);
+    free(color_p);
+
+    return EXIT_SUCCESS;
+}
+
+#endif /*FBDEV_BENCH*/
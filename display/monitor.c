@@ -21,6 +21,7 @@
 #include "../indev/mouse.h"
 #include "../indev/keyboard.h"
 #include "../indev/mousewheel.h"
+#include "pixconv.h"
 
 /*********************
  *      DEFINES
@@ -68,6 +69,7 @@ static void monitor_sdl_clean_up(void);
 static void monitor_sdl_init(void);
 static void sdl_event_handler(lv_task_t *t);
 static void monitor_sdl_refr(lv_task_t *t);
+static uint32_t *splash_begin(size_t logoWidth, size_t logoHeight, uint32_t bgColor);
 
 /***********************
  *   GLOBAL PROTOTYPES
@@ -101,6 +103,7 @@ void monitor_init(size_t w, size_t h)
     monitor.width = w;
     monitor.height = h;
     monitor.tft_fb = malloc(w * h * sizeof(uint32_t));
+    pixconv_init();
     monitor_sdl_init();
 #if LVGL_VERSION_MAJOR <= 7
     lv_task_create(sdl_event_handler, 10, LV_TASK_PRIO_HIGH, NULL);
@@ -135,14 +138,11 @@ void monitor_flush(lv_disp_drv_t *disp_drv, const lv_area_t *area, lv_color_t *c
 
     int32_t y;
 #if LV_COLOR_DEPTH != 24 && LV_COLOR_DEPTH != 32 /*32 is valid but support 24 for backward compatibility too*/
-    int32_t x;
+    uint32_t w = lv_area_get_width(area);
     for (y = area->y1; y <= area->y2 && y < disp_drv->ver_res; y++)
     {
-        for (x = area->x1; x <= area->x2; x++)
-        {
-            monitor.tft_fb[y * disp_drv->hor_res + x] = lv_color_to32(*color_p);
-            color_p++;
-        }
+        pixconv_lv_to_xrgb8888(&monitor.tft_fb[y * disp_drv->hor_res + area->x1], color_p, w);
+        color_p += w;
     }
 #else
     uint32_t w = lv_area_get_width(area);
@@ -198,14 +198,11 @@ void monitor_flush2(lv_disp_drv_t *disp_drv, const lv_area_t *area, lv_color_t *
 
     int32_t y;
 #if LV_COLOR_DEPTH != 24 && LV_COLOR_DEPTH != 32 /*32 is valid but support 24 for backward compatibility too*/
-    int32_t x;
+    uint32_t w = lv_area_get_width(area);
     for (y = area->y1; y <= area->y2 && y < disp_drv->ver_res; y++)
     {
-        for (x = area->x1; x <= area->x2; x++)
-        {
-            monitor2.tft_fb[y * disp_drv->hor_res + x] = lv_color_to32(*color_p);
-            color_p++;
-        }
+        pixconv_lv_to_xrgb8888(&monitor2.tft_fb[y * disp_drv->hor_res + area->x1], color_p, w);
+        color_p += w;
     }
 #else
     uint32_t w = lv_area_get_width(area);
@@ -403,33 +400,95 @@ static void window_create(monitor_t *m)
 #endif
 }
 
+/**
+ * Clear the window to `bgColor` and draw a 1 bpp logo in the middle of it with `fgColor`
+ * @param logoImage the logo, `(logoWidth + 7) / 8` bytes per line, the first pixel in bit 0
+ * @param logoWidth width of the logo
+ * @param logoHeight height of the logo
+ * @param fgColor ARGB8888 color of the set bits
+ * @param bgColor ARGB8888 color of the window and the cleared bits
+ */
 void monitor_splashscreen(const uint8_t *logoImage, size_t logoWidth, size_t logoHeight, uint32_t fgColor,
                           uint32_t bgColor)
 {
-    for (size_t y = 0; y < monitor.width * monitor.height; y++)
-    {
-        memcpy(&monitor.tft_fb[y], &bgColor, sizeof(uint32_t));
-    }
-
-    int x = (monitor.width - logoWidth) / 2;
-    int y = (monitor.height - logoHeight) / 2;
-    int32_t i, j, byteWidth = (logoWidth + 7) / 8;
+    uint32_t *dst = splash_begin(logoWidth, logoHeight, bgColor);
+    size_t byteWidth = (logoWidth + 7) / 8;
+    size_t i, j, k;
 
-    for (j = 0; j < logoHeight; j++)
+    for (j = 0; dst && j < logoHeight; j++)
     {
-        for (i = 0; i < logoWidth; i++)
+        const uint8_t *src = &logoImage[j * byteWidth];
+        for (i = 0; i < logoWidth; i += 8)
         {
-            if (logoImage[j * byteWidth + i / 8] & (1 << (i & 7)))
+            uint8_t b = src[i / 8];
+            size_t n = logoWidth - i < 8 ? logoWidth - i : 8;
+            /*The background is already there*/
+            if (b == 0x00)
+                continue;
+            if (b == 0xFF)
             {
-                memcpy(&monitor.tft_fb[(y + j) * monitor.width + x + i], &fgColor, sizeof(uint32_t));
+                pixconv_fill(&dst[i], &fgColor, sizeof(uint32_t), n);
+                continue;
+            }
+            for (k = 0; k < n; k++)
+            {
+                if (b & (1 << k))
+                    dst[i + k] = fgColor;
             }
         }
+        dst += monitor.width;
     }
 
     monitor.sdl_refr_qry = true;
     window_update(&monitor);
 }
 
+/**
+ * Like `monitor_splashscreen` but with a run-length encoded logo (see `fbdev_splashscreen_rle`
+ * for the format) which is decoded straight to the window
+ * @param rle the encoded logo
+ * @param rleSize size of `rle` in bytes
+ * @param logoWidth width of the logo
+ * @param logoHeight height of the logo
+ * @param fgColor ARGB8888 color of the foreground runs
+ * @param bgColor ARGB8888 color of the window and the background runs
+ */
+void monitor_splashscreen_rle(const uint8_t *rle, size_t rleSize, size_t logoWidth, size_t logoHeight,
+                              uint32_t fgColor, uint32_t bgColor)
+{
+    uint32_t *dst = splash_begin(logoWidth, logoHeight, bgColor);
+    pixconv_rle_t rle_dec;
+    pixconv_rle_span_t span;
+
+    pixconv_rle_init(&rle_dec, rle, rleSize, logoWidth, logoHeight);
+    while (dst && pixconv_rle_next(&rle_dec, &span))
+    {
+        /*Only the foreground needs to be drawn*/
+        if (span.fg)
+            pixconv_fill(&dst[span.y * monitor.width + span.x], &fgColor, sizeof(uint32_t), span.len);
+    }
+
+    monitor.sdl_refr_qry = true;
+    window_update(&monitor);
+}
+
+/**
+ * Clear the window for a splash screen
+ * @param logoWidth width of the logo
+ * @param logoHeight height of the logo
+ * @param bgColor ARGB8888 background color
+ * @return the top left pixel of the centered logo or NULL if it doesn't fit to the window
+ */
+static uint32_t *splash_begin(size_t logoWidth, size_t logoHeight, uint32_t bgColor)
+{
+    pixconv_fill(monitor.tft_fb, &bgColor, sizeof(uint32_t), monitor.width * monitor.height);
+
+    if (logoWidth > monitor.width || logoHeight > monitor.height)
+        return NULL;
+
+    return &monitor.tft_fb[(monitor.height - logoHeight) / 2 * monitor.width + (monitor.width - logoWidth) / 2];
+}
+
 static void window_update(monitor_t *m)
 {
 #if MONITOR_DOUBLE_BUFFERED == 0
@@ -0,0 +1,915 @@
+/**
+ * @file pixconv.c
+ *
+ */
+
+/*********************
+ *      INCLUDES
+ *********************/
+#include "pixconv.h"
+#if USE_FBDEV || USE_BSD_FBDEV || USE_DRM || USE_MONITOR || USE_GTK
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#define PIXCONV_SSE2 1
+#include <emmintrin.h>
+#else
+#define PIXCONV_SSE2 0
+#endif
+
+/*AVX2 is compiled per function and only used if the CPU reports it at runtime*/
+#if PIXCONV_SSE2 && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PIXCONV_AVX2 1
+#include <immintrin.h>
+#else
+#define PIXCONV_AVX2 0
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define PIXCONV_NEON 1
+#include <arm_neon.h>
+#else
+#define PIXCONV_NEON 0
+#endif
+
+/*********************
+ *      DEFINES
+ *********************/
+/*Pixels converted at once when an intermediate buffer is needed (LV_COLOR_16_SWAP)*/
+#define PIXCONV_CHUNK 256
+
+/*Streaming stores only pay off above a few cache lines*/
+#define PIXCONV_STREAM_MIN 128
+
+#if PIXCONV_NEON && defined(__aarch64__)
+#define PIXCONV_STNP 1
+#else
+#define PIXCONV_STNP 0
+#endif
+
+/**********************
+ *      TYPEDEFS
+ **********************/
+typedef struct {
+    void (*rgb565_to_xrgb8888)(uint32_t * dst, const uint16_t * src, uint32_t px);
+    void (*rgb565_to_rgb888)(uint8_t * dst, const uint16_t * src, uint32_t px);
+    void (*rgb565_to_bgr888)(uint8_t * dst, const uint16_t * src, uint32_t px);
+    void (*rgb565_swap)(uint16_t * dst, const uint16_t * src, uint32_t px);
+    void (*xrgb8888_to_rgb565)(uint16_t * dst, const uint32_t * src, uint32_t px);
+    void (*xrgb8888_to_bgr565)(uint16_t * dst, const uint32_t * src, uint32_t px);
+    void (*xrgb8888_to_rgb888)(uint8_t * dst, const uint32_t * src, uint32_t px);
+    void (*xrgb8888_to_bgr888)(uint8_t * dst, const uint32_t * src, uint32_t px);
+    void (*xrgb8888_to_xbgr8888)(uint32_t * dst, const uint32_t * src, uint32_t px);
+    const char * isa;
+} pixconv_kernels_t;
+
+/**********************
+ *  STATIC PROTOTYPES
+ **********************/
+static void rgb565_to_xrgb8888_c(uint32_t * dst, const uint16_t * src, uint32_t px);
+static void rgb565_to_rgb888_c(uint8_t * dst, const uint16_t * src, uint32_t px);
+static void rgb565_to_bgr888_c(uint8_t * dst, const uint16_t * src, uint32_t px);
+static void rgb565_swap_c(uint16_t * dst, const uint16_t * src, uint32_t px);
+static void xrgb8888_to_rgb565_c(uint16_t * dst, const uint32_t * src, uint32_t px);
+static void xrgb8888_to_bgr565_c(uint16_t * dst, const uint32_t * src, uint32_t px);
+static void xrgb8888_to_rgb888_c(uint8_t * dst, const uint32_t * src, uint32_t px);
+static void xrgb8888_to_bgr888_c(uint8_t * dst, const uint32_t * src, uint32_t px);
+static void xrgb8888_to_xbgr8888_c(uint32_t * dst, const uint32_t * src, uint32_t px);
+
+/**********************
+ *  STATIC VARIABLES
+ **********************/
+static pixconv_kernels_t kern = {
+    rgb565_to_xrgb8888_c, rgb565_to_rgb888_c,   rgb565_to_bgr888_c,   rgb565_swap_c,
+    xrgb8888_to_rgb565_c, xrgb8888_to_bgr565_c, xrgb8888_to_rgb888_c, xrgb8888_to_bgr888_c,
+    xrgb8888_to_xbgr8888_c, "scalar"
+};
+
+/**********************
+ *      MACROS
+ **********************/
+/*Expand 5/6 bit channels to 8 bit by bit replication so that 0x1F maps to 0xFF*/
+#define EXP5(v) ((uint32_t)(((v) << 3) | ((v) >> 2)))
+#define EXP6(v) ((uint32_t)(((v) << 2) | ((v) >> 4)))
+
+/**********************
+ *   STATIC FUNCTIONS
+ **********************/
+
+/*-----------------
+ * Scalar kernels
+ *----------------*/
+
+static void rgb565_to_xrgb8888_c(uint32_t * dst, const uint16_t * src, uint32_t px)
+{
+    uint32_t i;
+    for(i = 0; i < px; i++) {
+        uint32_t c = src[i];
+        dst[i]     = 0xFF000000 | (EXP5(c >> 11) << 16) | (EXP6((c >> 5) & 0x3F) << 8) | EXP5(c & 0x1F);
+    }
+}
+
+static void rgb565_to_rgb888_c(uint8_t * dst, const uint16_t * src, uint32_t px)
+{
+    uint32_t i;
+    for(i = 0; i < px; i++) {
+        uint32_t c = src[i];
+        *dst++     = EXP5(c & 0x1F);
+        *dst++     = EXP6((c >> 5) & 0x3F);
+        *dst++     = EXP5(c >> 11);
+    }
+}
+
+static void rgb565_to_bgr888_c(uint8_t * dst, const uint16_t * src, uint32_t px)
+{
+    uint32_t i;
+    for(i = 0; i < px; i++) {
+        uint32_t c = src[i];
+        *dst++     = EXP5(c >> 11);
+        *dst++     = EXP6((c >> 5) & 0x3F);
+        *dst++     = EXP5(c & 0x1F);
+    }
+}
+
+static void rgb565_swap_c(uint16_t * dst, const uint16_t * src, uint32_t px)
+{
+    uint32_t i;
+    for(i = 0; i < px; i++) {
+        dst[i] = (uint16_t)((src[i] << 8) | (src[i] >> 8));
+    }
+}
+
+static void xrgb8888_to_rgb565_c(uint16_t * dst, const uint32_t * src, uint32_t px)
+{
+    uint32_t i;
+    for(i = 0; i < px; i++) {
+        uint32_t c = src[i];
+        dst[i]     = (uint16_t)(((c >> 8) & 0xF800) | ((c >> 5) & 0x07E0) | ((c >> 3) & 0x001F));
+    }
+}
+
+static void xrgb8888_to_bgr565_c(uint16_t * dst, const uint32_t * src, uint32_t px)
+{
+    uint32_t i;
+    for(i = 0; i < px; i++) {
+        uint32_t c = src[i];
+        dst[i]     = (uint16_t)(((c << 8) & 0xF800) | ((c >> 5) & 0x07E0) | ((c >> 19) & 0x001F));
+    }
+}
+
+static void xrgb8888_to_rgb888_c(uint8_t * dst, const uint32_t * src, uint32_t px)
+{
+    uint32_t i;
+    for(i = 0; i < px; i++) {
+        uint32_t c = src[i];
+        *dst++     = c & 0xFF;
+        *dst++     = (c >> 8) & 0xFF;
+        *dst++     = (c >> 16) & 0xFF;
+    }
+}
+
+static void xrgb8888_to_bgr888_c(uint8_t * dst, const uint32_t * src, uint32_t px)
+{
+    uint32_t i;
+    for(i = 0; i < px; i++) {
+        uint32_t c = src[i];
+        *dst++     = (c >> 16) & 0xFF;
+        *dst++     = (c >> 8) & 0xFF;
+        *dst++     = c & 0xFF;
+    }
+}
+
+static void xrgb8888_to_xbgr8888_c(uint32_t * dst, const uint32_t * src, uint32_t px)
+{
+    uint32_t i;
+    for(i = 0; i < px; i++) {
+        uint32_t c = src[i];
+        dst[i]     = (c & 0xFF00FF00) | ((c >> 16) & 0xFF) | ((c & 0xFF) << 16);
+    }
+}
+
+/*-----------------
+ * SSE2 kernels
+ *----------------*/
+#if PIXCONV_SSE2
+
+static inline void rgb565x8_to_xrgb8888_sse2(uint32_t * dst, __m128i p)
+{
+    const __m128i m6 = _mm_set1_epi16(0x3F);
+    const __m128i m5 = _mm_set1_epi16(0x1F);
+    __m128i r        = _mm_srli_epi16(p, 11);
+    __m128i g        = _mm_and_si128(_mm_srli_epi16(p, 5), m6);
+    __m128i b        = _mm_and_si128(p, m5);
+
+    r = _mm_or_si128(_mm_slli_epi16(r, 3), _mm_srli_epi16(r, 2));
+    g = _mm_or_si128(_mm_slli_epi16(g, 2), _mm_srli_epi16(g, 4));
+    b = _mm_or_si128(_mm_slli_epi16(b, 3), _mm_srli_epi16(b, 2));
+
+    /*Low half-word: B | G << 8, high half-word: R | 0xFF << 8*/
+    __m128i gb = _mm_or_si128(b, _mm_slli_epi16(g, 8));
+    __m128i ar = _mm_or_si128(r, _mm_set1_epi16((short)0xFF00));
+
+    _mm_storeu_si128((__m128i *)dst, _mm_unpacklo_epi16(gb, ar));
+    _mm_storeu_si128((__m128i *)(dst + 4), _mm_unpackhi_epi16(gb, ar));
+}
+
+static void rgb565_to_xrgb8888_sse2(uint32_t * dst, const uint16_t * src, uint32_t px)
+{
+    uint32_t i = 0;
+    for(; i + 8 <= px; i += 8) {
+        rgb565x8_to_xrgb8888_sse2(dst + i, _mm_loadu_si128((const __m128i *)(src + i)));
+    }
+    rgb565_to_xrgb8888_c(dst + i, src + i, px - i);
+}
+
+static void rgb565_swap_sse2(uint16_t * dst, const uint16_t * src, uint32_t px)
+{
+    uint32_t i = 0;
+    for(; i + 8 <= px; i += 8) {
+        __m128i p = _mm_loadu_si128((const __m128i *)(src + i));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_or_si128(_mm_slli_epi16(p, 8), _mm_srli_epi16(p, 8)));
+    }
+    rgb565_swap_c(dst + i, src + i, px - i);
+}
+
+/*Pack the low half-words of 2x4 32 bit lanes. Sign extending first keeps `packs` from saturating.*/
+static inline __m128i pack_lo16_sse2(__m128i a, __m128i b)
+{
+    a = _mm_srai_epi32(_mm_slli_epi32(a, 16), 16);
+    b = _mm_srai_epi32(_mm_slli_epi32(b, 16), 16);
+    return _mm_packs_epi32(a, b);
+}
+
+static inline __m128i xrgb8888x4_to_rgb565_sse2(__m128i c)
+{
+    __m128i r = _mm_and_si128(_mm_srli_epi32(c, 8), _mm_set1_epi32(0xF800));
+    __m128i g = _mm_and_si128(_mm_srli_epi32(c, 5), _mm_set1_epi32(0x07E0));
+    __m128i b = _mm_and_si128(_mm_srli_epi32(c, 3), _mm_set1_epi32(0x001F));
+    return _mm_or_si128(_mm_or_si128(r, g), b);
+}
+
+static inline __m128i xrgb8888x4_to_bgr565_sse2(__m128i c)
+{
+    __m128i b = _mm_and_si128(_mm_slli_epi32(c, 8), _mm_set1_epi32(0xF800));
+    __m128i g = _mm_and_si128(_mm_srli_epi32(c, 5), _mm_set1_epi32(0x07E0));
+    __m128i r = _mm_and_si128(_mm_srli_epi32(c, 19), _mm_set1_epi32(0x001F));
+    return _mm_or_si128(_mm_or_si128(r, g), b);
+}
+
+static void xrgb8888_to_rgb565_sse2(uint16_t * dst, const uint32_t * src, uint32_t px)
+{
+    uint32_t i = 0;
+    for(; i + 8 <= px; i += 8) {
+        __m128i a = xrgb8888x4_to_rgb565_sse2(_mm_loadu_si128((const __m128i *)(src + i)));
+        __m128i b = xrgb8888x4_to_rgb565_sse2(_mm_loadu_si128((const __m128i *)(src + i + 4)));
+        _mm_storeu_si128((__m128i *)(dst + i), pack_lo16_sse2(a, b));
+    }
+    xrgb8888_to_rgb565_c(dst + i, src + i, px - i);
+}
+
+static void xrgb8888_to_bgr565_sse2(uint16_t * dst, const uint32_t * src, uint32_t px)
+{
+    uint32_t i = 0;
+    for(; i + 8 <= px; i += 8) {
+        __m128i a = xrgb8888x4_to_bgr565_sse2(_mm_loadu_si128((const __m128i *)(src + i)));
+        __m128i b = xrgb8888x4_to_bgr565_sse2(_mm_loadu_si128((const __m128i *)(src + i + 4)));
+        _mm_storeu_si128((__m128i *)(dst + i), pack_lo16_sse2(a, b));
+    }
+    xrgb8888_to_bgr565_c(dst + i, src + i, px - i);
+}
+
+static void xrgb8888_to_xbgr8888_sse2(uint32_t * dst, const uint32_t * src, uint32_t px)
+{
+    const __m128i mag = _mm_set1_epi32(0xFF00FF00);
+    const __m128i lo  = _mm_set1_epi32(0xFF);
+    uint32_t i = 0;
+    for(; i + 4 <= px; i += 4) {
+        __m128i c  = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i rb = _mm_or_si128(_mm_and_si128(_mm_srli_epi32(c, 16), lo), _mm_slli_epi32(_mm_and_si128(c, lo), 16));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_or_si128(_mm_and_si128(c, mag), rb));
+    }
+    xrgb8888_to_xbgr8888_c(dst + i, src + i, px - i);
+}
+
+#endif /*PIXCONV_SSE2*/
+
+/*-----------------
+ * AVX2 kernels
+ *----------------*/
+#if PIXCONV_AVX2
+
+__attribute__((target("avx2"))) static void rgb565_to_xrgb8888_avx2(uint32_t * dst, const uint16_t * src,
+                                                                     uint32_t px)
+{
+    const __m256i m6 = _mm256_set1_epi16(0x3F);
+    const __m256i m5 = _mm256_set1_epi16(0x1F);
+    const __m256i a  = _mm256_set1_epi16((short)0xFF00);
+    uint32_t i       = 0;
+
+    for(; i + 16 <= px; i += 16) {
+        __m256i p = _mm256_loadu_si256((const __m256i *)(src + i));
+        __m256i r = _mm256_srli_epi16(p, 11);
+        __m256i g = _mm256_and_si256(_mm256_srli_epi16(p, 5), m6);
+        __m256i b = _mm256_and_si256(p, m5);
+
+        r = _mm256_or_si256(_mm256_slli_epi16(r, 3), _mm256_srli_epi16(r, 2));
+        g = _mm256_or_si256(_mm256_slli_epi16(g, 2), _mm256_srli_epi16(g, 4));
+        b = _mm256_or_si256(_mm256_slli_epi16(b, 3), _mm256_srli_epi16(b, 2));
+
+        __m256i gb = _mm256_or_si256(b, _mm256_slli_epi16(g, 8));
+        __m256i ar = _mm256_or_si256(r, a);
+
+        /*Unpack works per 128 bit lane: lo = px 0-3, 8-11; hi = px 4-7, 12-15*/
+        __m256i lo = _mm256_unpacklo_epi16(gb, ar);
+        __m256i hi = _mm256_unpackhi_epi16(gb, ar);
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_storeu_si256((__m256i *)(dst + i + 8), _mm256_permute2x128_si256(lo, hi, 0x31));
+    }
+    rgb565_to_xrgb8888_c(dst + i, src + i, px - i);
+}
+
+__attribute__((target("avx2"))) static void rgb565_swap_avx2(uint16_t * dst, const uint16_t * src, uint32_t px)
+{
+    uint32_t i = 0;
+    for(; i + 16 <= px; i += 16) {
+        __m256i p = _mm256_loadu_si256((const __m256i *)(src + i));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_or_si256(_mm256_slli_epi16(p, 8), _mm256_srli_epi16(p, 8)));
+    }
+    rgb565_swap_c(dst + i, src + i, px - i);
+}
+
+__attribute__((target("avx2"))) static inline __m256i pack_lo16_avx2(__m256i a, __m256i b)
+{
+    a = _mm256_srai_epi32(_mm256_slli_epi32(a, 16), 16);
+    b = _mm256_srai_epi32(_mm256_slli_epi32(b, 16), 16);
+    /*Pack works per 128 bit lane: a0-3, b0-3, a4-7, b4-7. Restore the order.*/
+    return _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0xD8);
+}
+
+__attribute__((target("avx2"))) static void xrgb8888_to_rgb565_avx2(uint16_t * dst, const uint32_t * src,
+                                                                     uint32_t px)
+{
+    const __m256i mr = _mm256_set1_epi32(0xF800);
+    const __m256i mg = _mm256_set1_epi32(0x07E0);
+    const __m256i mb = _mm256_set1_epi32(0x001F);
+    uint32_t i       = 0;
+
+    for(; i + 16 <= px; i += 16) {
+        __m256i c0 = _mm256_loadu_si256((const __m256i *)(src + i));
+        __m256i c1 = _mm256_loadu_si256((const __m256i *)(src + i + 8));
+        c0         = _mm256_or_si256(_mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(c0, 8), mr),
+                                                     _mm256_and_si256(_mm256_srli_epi32(c0, 5), mg)),
+                                     _mm256_and_si256(_mm256_srli_epi32(c0, 3), mb));
+        c1         = _mm256_or_si256(_mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(c1, 8), mr),
+                                                     _mm256_and_si256(_mm256_srli_epi32(c1, 5), mg)),
+                                     _mm256_and_si256(_mm256_srli_epi32(c1, 3), mb));
+        _mm256_storeu_si256((__m256i *)(dst + i), pack_lo16_avx2(c0, c1));
+    }
+    xrgb8888_to_rgb565_c(dst + i, src + i, px - i);
+}
+
+__attribute__((target("avx2"))) static void xrgb8888_to_bgr565_avx2(uint16_t * dst, const uint32_t * src,
+                                                                     uint32_t px)
+{
+    const __m256i mb = _mm256_set1_epi32(0xF800);
+    const __m256i mg = _mm256_set1_epi32(0x07E0);
+    const __m256i mr = _mm256_set1_epi32(0x001F);
+    uint32_t i       = 0;
+
+    for(; i + 16 <= px; i += 16) {
+        __m256i c0 = _mm256_loadu_si256((const __m256i *)(src + i));
+        __m256i c1 = _mm256_loadu_si256((const __m256i *)(src + i + 8));
+        c0         = _mm256_or_si256(_mm256_or_si256(_mm256_and_si256(_mm256_slli_epi32(c0, 8), mb),
+                                                     _mm256_and_si256(_mm256_srli_epi32(c0, 5), mg)),
+                                     _mm256_and_si256(_mm256_srli_epi32(c0, 19), mr));
+        c1         = _mm256_or_si256(_mm256_or_si256(_mm256_and_si256(_mm256_slli_epi32(c1, 8), mb),
+                                                     _mm256_and_si256(_mm256_srli_epi32(c1, 5), mg)),
+                                     _mm256_and_si256(_mm256_srli_epi32(c1, 19), mr));
+        _mm256_storeu_si256((__m256i *)(dst + i), pack_lo16_avx2(c0, c1));
+    }
+    xrgb8888_to_bgr565_c(dst + i, src + i, px - i);
+}
+
+#endif /*PIXCONV_AVX2*/
+
+/*-----------------
+ * NEON kernels
+ *----------------*/
+#if PIXCONV_NEON
+
+/*Split 8 RGB565 pixels to 8 bit channels with bit replication*/
+static inline void rgb565x8_split_neon(uint16x8_t p, uint8x8_t * r, uint8x8_t * g, uint8x8_t * b)
+{
+    uint8x8_t vr = vshrn_n_u16(p, 8);            /*rrrrrggg*/
+    uint8x8_t vg = vshrn_n_u16(p, 3);            /*ggggggbb*/
+    uint8x8_t vb = vmovn_u16(vshlq_n_u16(p, 3)); /*bbbbb000*/
+    *r           = vsri_n_u8(vr, vr, 5);
+    *g           = vsri_n_u8(vg, vg, 6);
+    *b           = vsri_n_u8(vb, vb, 5);
+}
+
+static void rgb565_to_xrgb8888_neon(uint32_t * dst, const uint16_t * src, uint32_t px)
+{
+    uint32_t i = 0;
+    uint8x8x4_t v;
+    v.val[3] = vdup_n_u8(0xFF);
+    for(; i + 8 <= px; i += 8) {
+        rgb565x8_split_neon(vld1q_u16(src + i), &v.val[2], &v.val[1], &v.val[0]);
+        vst4_u8((uint8_t *)(dst + i), v);
+    }
+    rgb565_to_xrgb8888_c(dst + i, src + i, px - i);
+}
+
+static void rgb565_to_rgb888_neon(uint8_t * dst, const uint16_t * src, uint32_t px)
+{
+    uint32_t i = 0;
+    uint8x8x3_t v;
+    for(; i + 8 <= px; i += 8) {
+        rgb565x8_split_neon(vld1q_u16(src + i), &v.val[2], &v.val[1], &v.val[0]);
+        vst3_u8(dst + i * 3, v);
+    }
+    rgb565_to_rgb888_c(dst + i * 3, src + i, px - i);
+}
+
+static void rgb565_to_bgr888_neon(uint8_t * dst, const uint16_t * src, uint32_t px)
+{
+    uint32_t i = 0;
+    uint8x8x3_t v;
+    for(; i + 8 <= px; i += 8) {
+        rgb565x8_split_neon(vld1q_u16(src + i), &v.val[0], &v.val[1], &v.val[2]);
+        vst3_u8(dst + i * 3, v);
+    }
+    rgb565_to_bgr888_c(dst + i * 3, src + i, px - i);
+}
+
+static void rgb565_swap_neon(uint16_t * dst, const uint16_t * src, uint32_t px)
+{
+    uint32_t i = 0;
+    for(; i + 8 <= px; i += 8) {
+        uint8x16_t p = vld1q_u8((const uint8_t *)(src + i));
+        vst1q_u8((uint8_t *)(dst + i), vrev16q_u8(p));
+    }
+    rgb565_swap_c(dst + i, src + i, px - i);
+}
+
+static inline uint16x8_t pack565_neon(uint8x8_t hi, uint8x8_t mid, uint8x8_t lo)
+{
+    uint16x8_t p = vshll_n_u8(hi, 8);
+    p            = vsriq_n_u16(p, vshll_n_u8(mid, 8), 5);
+    return vsriq_n_u16(p, vshll_n_u8(lo, 8), 11);
+}
+
+static void xrgb8888_to_rgb565_neon(uint16_t * dst, const uint32_t * src, uint32_t px)
+{
+    uint32_t i = 0;
+    for(; i + 8 <= px; i += 8) {
+        uint8x8x4_t v = vld4_u8((const uint8_t *)(src + i));
+        vst1q_u16(dst + i, pack565_neon(v.val[2], v.val[1], v.val[0]));
+    }
+    xrgb8888_to_rgb565_c(dst + i, src + i, px - i);
+}
+
+static void xrgb8888_to_bgr565_neon(uint16_t * dst, const uint32_t * src, uint32_t px)
+{
+    uint32_t i = 0;
+    for(; i + 8 <= px; i += 8) {
+        uint8x8x4_t v = vld4_u8((const uint8_t *)(src + i));
+        vst1q_u16(dst + i, pack565_neon(v.val[0], v.val[1], v.val[2]));
+    }
+    xrgb8888_to_bgr565_c(dst + i, src + i, px - i);
+}
+
+static void xrgb8888_to_rgb888_neon(uint8_t * dst, const uint32_t * src, uint32_t px)
+{
+    uint32_t i = 0;
+    for(; i + 8 <= px; i += 8) {
+        uint8x8x4_t v = vld4_u8((const uint8_t *)(src + i));
+        uint8x8x3_t o = {{v.val[0], v.val[1], v.val[2]}};
+        vst3_u8(dst + i * 3, o);
+    }
+    xrgb8888_to_rgb888_c(dst + i * 3, src + i, px - i);
+}
+
+static void xrgb8888_to_bgr888_neon(uint8_t * dst, const uint32_t * src, uint32_t px)
+{
+    uint32_t i = 0;
+    for(; i + 8 <= px; i += 8) {
+        uint8x8x4_t v = vld4_u8((const uint8_t *)(src + i));
+        uint8x8x3_t o = {{v.val[2], v.val[1], v.val[0]}};
+        vst3_u8(dst + i * 3, o);
+    }
+    xrgb8888_to_bgr888_c(dst + i * 3, src + i, px - i);
+}
+
+static void xrgb8888_to_xbgr8888_neon(uint32_t * dst, const uint32_t * src, uint32_t px)
+{
+    uint32_t i = 0;
+    for(; i + 8 <= px; i += 8) {
+        uint8x8x4_t v = vld4_u8((const uint8_t *)(src + i));
+        uint8x8_t t   = v.val[0];
+        v.val[0]      = v.val[2];
+        v.val[2]      = t;
+        vst4_u8((uint8_t *)(dst + i), v);
+    }
+    xrgb8888_to_xbgr8888_c(dst + i, src + i, px - i);
+}
+
+#endif /*PIXCONV_NEON*/
+
+/*-----------------
+ * Kernel selection
+ *----------------*/
+
+#if PIXCONV_SSE2
+static void pixconv_kernels_sse2(pixconv_kernels_t * k)
+{
+    k->rgb565_to_xrgb8888   = rgb565_to_xrgb8888_sse2;
+    k->rgb565_swap          = rgb565_swap_sse2;
+    k->xrgb8888_to_rgb565   = xrgb8888_to_rgb565_sse2;
+    k->xrgb8888_to_bgr565   = xrgb8888_to_bgr565_sse2;
+    k->xrgb8888_to_xbgr8888 = xrgb8888_to_xbgr8888_sse2;
+    k->isa                  = "sse2";
+}
+#endif
+
+#if PIXCONV_AVX2
+/*Replaces some of the SSE2 kernels, if the CPU has AVX2. Return true if it has.*/
+static bool pixconv_kernels_avx2(pixconv_kernels_t * k)
+{
+    __builtin_cpu_init();
+    if(!__builtin_cpu_supports("avx2")) return false;
+
+    k->rgb565_to_xrgb8888 = rgb565_to_xrgb8888_avx2;
+    k->rgb565_swap        = rgb565_swap_avx2;
+    k->xrgb8888_to_rgb565 = xrgb8888_to_rgb565_avx2;
+    k->xrgb8888_to_bgr565 = xrgb8888_to_bgr565_avx2;
+    k->isa                = "avx2";
+    return true;
+}
+#endif
+
+#if PIXCONV_NEON
+static void pixconv_kernels_neon(pixconv_kernels_t * k)
+{
+    k->rgb565_to_xrgb8888   = rgb565_to_xrgb8888_neon;
+    k->rgb565_to_rgb888     = rgb565_to_rgb888_neon;
+    k->rgb565_to_bgr888     = rgb565_to_bgr888_neon;
+    k->rgb565_swap          = rgb565_swap_neon;
+    k->xrgb8888_to_rgb565   = xrgb8888_to_rgb565_neon;
+    k->xrgb8888_to_bgr565   = xrgb8888_to_bgr565_neon;
+    k->xrgb8888_to_rgb888   = xrgb8888_to_rgb888_neon;
+    k->xrgb8888_to_bgr888   = xrgb8888_to_bgr888_neon;
+    k->xrgb8888_to_xbgr8888 = xrgb8888_to_xbgr8888_neon;
+    k->isa                  = "neon";
+}
+#endif
+
+/**********************
+ *   GLOBAL FUNCTIONS
+ **********************/
+
+void pixconv_init(void)
+{
+#if PIXCONV_SSE2
+    pixconv_kernels_sse2(&kern);
+#endif
+
+#if PIXCONV_AVX2
+    pixconv_kernels_avx2(&kern);
+#endif
+
+#if PIXCONV_NEON
+    pixconv_kernels_neon(&kern);
+#endif
+}
+
+const char * pixconv_get_isa(void)
+{
+    return kern.isa;
+}
+
+void pixconv_rgb565_to_xrgb8888(uint32_t * dst, const uint16_t * src, uint32_t px)
+{
+    kern.rgb565_to_xrgb8888(dst, src, px);
+}
+
+void pixconv_rgb565_to_rgb888(uint8_t * dst, const uint16_t * src, uint32_t px)
+{
+    kern.rgb565_to_rgb888(dst, src, px);
+}
+
+void pixconv_rgb565_to_bgr888(uint8_t * dst, const uint16_t * src, uint32_t px)
+{
+    kern.rgb565_to_bgr888(dst, src, px);
+}
+
+void pixconv_rgb565_to_rgb332(uint8_t * dst, const uint16_t * src, uint32_t px)
+{
+    uint32_t i;
+    for(i = 0; i < px; i++) {
+        uint32_t c = src[i];
+        dst[i]     = (uint8_t)(((c >> 8) & 0xE0) | ((c >> 6) & 0x1C) | ((c >> 3) & 0x03));
+    }
+}
+
+void pixconv_rgb565_swap(uint16_t * dst, const uint16_t * src, uint32_t px)
+{
+    kern.rgb565_swap(dst, src, px);
+}
+
+void pixconv_xrgb8888_to_rgb565(uint16_t * dst, const uint32_t * src, uint32_t px)
+{
+    kern.xrgb8888_to_rgb565(dst, src, px);
+}
+
+void pixconv_xrgb8888_to_bgr565(uint16_t * dst, const uint32_t * src, uint32_t px)
+{
+    kern.xrgb8888_to_bgr565(dst, src, px);
+}
+
+void pixconv_xrgb8888_to_rgb888(uint8_t * dst, const uint32_t * src, uint32_t px)
+{
+    kern.xrgb8888_to_rgb888(dst, src, px);
+}
+
+void pixconv_xrgb8888_to_bgr888(uint8_t * dst, const uint32_t * src, uint32_t px)
+{
+    kern.xrgb8888_to_bgr888(dst, src, px);
+}
+
+void pixconv_xrgb8888_to_xbgr8888(uint32_t * dst, const uint32_t * src, uint32_t px)
+{
+    kern.xrgb8888_to_xbgr8888(dst, src, px);
+}
+
+void pixconv_xrgb8888_to_rgb332(uint8_t * dst, const uint32_t * src, uint32_t px)
+{
+    uint32_t i;
+    for(i = 0; i < px; i++) {
+        uint32_t c = src[i];
+        dst[i]     = (uint8_t)(((c >> 16) & 0xE0) | ((c >> 11) & 0x1C) | ((c >> 6) & 0x03));
+    }
+}
+
+/*-----------------
+ * lv_color_t rows
+ *----------------*/
+
+#if LV_COLOR_DEPTH == 16 && LV_COLOR_16_SWAP
+/*Byte swapped LVGL colors are swapped into a stack buffer first, `kernel` is then run on each chunk*/
+#define PIXCONV_LV_CHUNKED(dst, dst_px_size, src, px, kernel)                                                     \
+    do {                                                                                                           \
+        uint16_t tmp[PIXCONV_CHUNK];                                                                               \
+        const uint16_t * s = (const uint16_t *)(src);                                                              \
+        uint8_t * d        = (uint8_t *)(dst);                                                                     \
+        uint32_t n;                                                                                                \
+        while(px > 0) {                                                                                            \
+            n = px > PIXCONV_CHUNK ? PIXCONV_CHUNK : px;                                                           \
+            kern.rgb565_swap(tmp, s, n);                                                                           \
+            kernel((void *)d, tmp, n);                                                                             \
+            s += n;                                                                                                \
+            d += n * (dst_px_size);                                                                                \
+            px -= n;                                                                                               \
+        }                                                                                                          \
+    } while(0)
+#endif
+
+void pixconv_lv_to_xrgb8888(uint32_t * dst, const lv_color_t * src, uint32_t px)
+{
+#if LV_COLOR_DEPTH == 32
+    memcpy(dst, src, px * sizeof(uint32_t));
+#elif LV_COLOR_DEPTH == 16 && LV_COLOR_16_SWAP
+    PIXCONV_LV_CHUNKED(dst, 4, src, px, kern.rgb565_to_xrgb8888);
+#elif LV_COLOR_DEPTH == 16
+    kern.rgb565_to_xrgb8888(dst, (const uint16_t *)src, px);
+#else
+    uint32_t i;
+    for(i = 0; i < px; i++) dst[i] = lv_color_to32(src[i]);
+#endif
+}
+
+void pixconv_lv_to_xbgr8888(uint32_t * dst, const lv_color_t * src, uint32_t px)
+{
+#if LV_COLOR_DEPTH == 32
+    kern.xrgb8888_to_xbgr8888(dst, (const uint32_t *)src, px);
+#else
+    /*Swapping R and B works in place*/
+    pixconv_lv_to_xrgb8888(dst, src, px);
+    kern.xrgb8888_to_xbgr8888(dst, dst, px);
+#endif
+}
+
+void pixconv_lv_to_rgb565(uint16_t * dst, const lv_color_t * src, uint32_t px)
+{
+#if LV_COLOR_DEPTH == 32
+    kern.xrgb8888_to_rgb565(dst, (const uint32_t *)src, px);
+#elif LV_COLOR_DEPTH == 16 && LV_COLOR_16_SWAP
+    kern.rgb565_swap(dst, (const uint16_t *)src, px);
+#elif LV_COLOR_DEPTH == 16
+    memcpy(dst, src, px * sizeof(uint16_t));
+#else
+    uint32_t i;
+    for(i = 0; i < px; i++) dst[i] = lv_color_to16(src[i]);
+#endif
+}
+
+void pixconv_lv_to_bgr565(uint16_t * dst, const lv_color_t * src, uint32_t px)
+{
+#if LV_COLOR_DEPTH == 32
+    kern.xrgb8888_to_bgr565(dst, (const uint32_t *)src, px);
+#else
+    uint32_t i;
+    pixconv_lv_to_rgb565(dst, src, px);
+    for(i = 0; i < px; i++) {
+        uint16_t c = dst[i];
+        dst[i]     = (uint16_t)((c << 11) | (c & 0x07E0) | (c >> 11));
+    }
+#endif
+}
+
+void pixconv_lv_to_rgb888(uint8_t * dst, const lv_color_t * src, uint32_t px)
+{
+#if LV_COLOR_DEPTH == 32
+    kern.xrgb8888_to_rgb888(dst, (const uint32_t *)src, px);
+#elif LV_COLOR_DEPTH == 16 && LV_COLOR_16_SWAP
+    PIXCONV_LV_CHUNKED(dst, 3, src, px, kern.rgb565_to_rgb888);
+#elif LV_COLOR_DEPTH == 16
+    kern.rgb565_to_rgb888(dst, (const uint16_t *)src, px);
+#else
+    uint32_t i;
+    for(i = 0; i < px; i++) {
+        uint32_t c = lv_color_to32(src[i]);
+        *dst++     = c & 0xFF;
+        *dst++     = (c >> 8) & 0xFF;
+        *dst++     = (c >> 16) & 0xFF;
+    }
+#endif
+}
+
+void pixconv_lv_to_bgr888(uint8_t * dst, const lv_color_t * src, uint32_t px)
+{
+#if LV_COLOR_DEPTH == 32
+    kern.xrgb8888_to_bgr888(dst, (const uint32_t *)src, px);
+#elif LV_COLOR_DEPTH == 16 && LV_COLOR_16_SWAP
+    PIXCONV_LV_CHUNKED(dst, 3, src, px, kern.rgb565_to_bgr888);
+#elif LV_COLOR_DEPTH == 16
+    kern.rgb565_to_bgr888(dst, (const uint16_t *)src, px);
+#else
+    uint32_t i;
+    for(i = 0; i < px; i++) {
+        uint32_t c = lv_color_to32(src[i]);
+        *dst++     = (c >> 16) & 0xFF;
+        *dst++     = (c >> 8) & 0xFF;
+        *dst++     = c & 0xFF;
+    }
+#endif
+}
+
+void pixconv_lv_to_rgb332(uint8_t * dst, const lv_color_t * src, uint32_t px)
+{
+#if LV_COLOR_DEPTH == 32
+    pixconv_xrgb8888_to_rgb332(dst, (const uint32_t *)src, px);
+#elif LV_COLOR_DEPTH == 16 && LV_COLOR_16_SWAP
+    PIXCONV_LV_CHUNKED(dst, 1, src, px, pixconv_rgb565_to_rgb332);
+#elif LV_COLOR_DEPTH == 16
+    pixconv_rgb565_to_rgb332(dst, (const uint16_t *)src, px);
+#elif LV_COLOR_DEPTH == 8
+    memcpy(dst, src, px);
+#else
+    uint32_t i;
+    for(i = 0; i < px; i++) dst[i] = lv_color_to8(src[i]);
+#endif
+}
+
+/*-----------------
+ * Streaming copy
+ *----------------*/
+
+void pixconv_copy_stream(void * dst, const void * src, size_t size)
+{
+#if PIXCONV_SSE2 || PIXCONV_STNP
+    uint8_t * d       = dst;
+    const uint8_t * s = src;
+    size_t head;
+
+    if(size < PIXCONV_STREAM_MIN) {
+        memcpy(dst, src, size);
+        return;
+    }
+
+    /*Plain stores up to the first 16 byte boundary of the destination*/
+    head = (16 - ((uintptr_t)d & 15)) & 15;
+    memcpy(d, s, head);
+    d += head;
+    s += head;
+    size -= head;
+
+    for(; size >= 64; size -= 64, d += 64, s += 64) {
+#if PIXCONV_SSE2
+        __m128i a = _mm_loadu_si128((const __m128i *)s);
+        __m128i b = _mm_loadu_si128((const __m128i *)(s + 16));
+        __m128i c = _mm_loadu_si128((const __m128i *)(s + 32));
+        __m128i e = _mm_loadu_si128((const __m128i *)(s + 48));
+        _mm_stream_si128((__m128i *)d, a);
+        _mm_stream_si128((__m128i *)(d + 16), b);
+        _mm_stream_si128((__m128i *)(d + 32), c);
+        _mm_stream_si128((__m128i *)(d + 48), e);
+#else
+        uint8x16_t a = vld1q_u8(s);
+        uint8x16_t b = vld1q_u8(s + 16);
+        uint8x16_t c = vld1q_u8(s + 32);
+        uint8x16_t e = vld1q_u8(s + 48);
+        __asm__ volatile("stnp %q1, %q2, [%0]\n\t"
+                         "stnp %q3, %q4, [%0, #32]"
+                         :
+                         : "r"(d), "w"(a), "w"(b), "w"(c), "w"(e)
+                         : "memory");
+#endif
+    }
+
+    /*Tail with plain stores*/
+    memcpy(d, s, size);
+#else
+    memcpy(dst, src, size);
+#endif
+}
+
+void pixconv_stream_fence(void)
+{
+#if PIXCONV_SSE2
+    _mm_sfence();
+#elif PIXCONV_STNP
+    __asm__ volatile("dmb ishst" ::: "memory");
+#endif
+}
+
+/*-----------------
+ * Splash screens
+ *----------------*/
+
+void pixconv_fill(void * buf, const void * pixel, size_t size, size_t px)
+{
+    uint8_t * b = buf;
+    size_t n;
+
+    if(px == 0) return;
+
+    memcpy(b, pixel, size);
+    for(n = 1; n < px; n *= 2) {
+        memcpy(&b[n * size], b, (n < px - n ? n : px - n) * size);
+    }
+}
+
+void pixconv_rle_init(pixconv_rle_t * rle, const uint8_t * data, size_t size, size_t w, size_t h)
+{
+    memset(rle, 0, sizeof(pixconv_rle_t));
+    rle->data = data;
+    rle->size = size;
+    rle->w    = w;
+    rle->h    = h;
+    rle->fg   = true; /*Switched to background by the first run*/
+}
+
+bool pixconv_rle_next(pixconv_rle_t * rle, pixconv_rle_span_t * span)
+{
+    if(rle->w == 0 || rle->y >= rle->h) return false;
+
+    while(rle->run == 0) {
+        if(rle->pos >= rle->size) {
+            /*Missing pixels of a started line are background*/
+            if(rle->x == 0) return false;
+            rle->run = rle->w - rle->x;
+            rle->fg  = false;
+            break;
+        }
+
+        /*Read the length of the next run*/
+        uint32_t shift = 0;
+        uint8_t b;
+        do {
+            b = rle->data[rle->pos++];
+            if(shift < sizeof(size_t) * 8) rle->run |= (size_t)(b & 0x7F) << shift;
+            shift += 7;
+        } while((b & 0x80) && rle->pos < rle->size);
+        rle->fg = !rle->fg;
+    }
+
+    span->x   = rle->x;
+    span->y   = rle->y;
+    span->len = rle->w - rle->x < rle->run ? rle->w - rle->x : rle->run;
+    span->fg  = rle->fg;
+
+    rle->run -= span->len;
+    rle->x += span->len;
+    if(rle->x == rle->w) {
+        rle->x = 0;
+        rle->y++;
+    }
+
+    return true;
+}
+
+#endif /*USE_FBDEV || USE_BSD_FBDEV || USE_DRM || USE_MONITOR || USE_GTK*/
@@ -0,0 +1,168 @@
+/**
+ * @file pixconv.h
+ * Row based pixel format conversion shared by the Linux/desktop drivers.
+ *
+ * Format names follow the DRM fourcc convention, i.e. they describe the
+ * pixel as a little-endian word:
+ *  - XRGB8888: 32 bit, 0xXXRRGGBB (bytes B, G, R, X in memory)
+ *  - XBGR8888: 32 bit, 0xXXBBGGRR (bytes R, G, B, X in memory)
+ *  - RGB565 / BGR565: 16 bit, red resp. blue in the upper 5 bits
+ *  - RGB888: 24 bit, bytes B, G, R in memory (fbdev 24bpp)
+ *  - BGR888: 24 bit, bytes R, G, B in memory (GdkPixbuf RGB)
+ *  - RGB332: 8 bit, rrrgggbb
+ */
+
+#ifndef PIXCONV_H
+#define PIXCONV_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*********************
+ *      INCLUDES
+ *********************/
+#ifndef LV_DRV_NO_CONF
+#ifdef LV_CONF_INCLUDE_SIMPLE
+#include "lv_drv_conf.h"
+#else
+#include "../../lv_drv_conf.h"
+#endif
+#endif
+
+#if USE_FBDEV || USE_BSD_FBDEV || USE_DRM || USE_MONITOR || USE_GTK
+
+#ifdef LV_LVGL_H_INCLUDE_SIMPLE
+#include "lvgl.h"
+#else
+#include "lvgl/lvgl.h"
+#endif
+
+/*********************
+ *      DEFINES
+ *********************/
+
+/**********************
+ *      TYPEDEFS
+ **********************/
+/**
+ * Decoder state of a run-length encoded 1 bpp image: alternating runs of background and foreground
+ * pixels in line order, starting with background. Each run length is an unsigned LEB128 number
+ * (7 bits per byte, least significant group first, bit 7 set if more bytes follow).
+ * Runs can span lines, a 0 length run only switches the color.
+ */
+typedef struct {
+    const uint8_t * data;
+    size_t size;
+    size_t pos;  /*Next byte of `data`*/
+    size_t w;
+    size_t h;
+    size_t x;    /*Position of the next span*/
+    size_t y;
+    size_t run;  /*Pixels left of the current run*/
+    bool fg;     /*Color of the current run*/
+} pixconv_rle_t;
+
+/**
+ * Pixels of one color in one line of a run-length encoded image
+ */
+typedef struct {
+    size_t x;
+    size_t y;
+    size_t len;
+    bool fg;
+} pixconv_rle_span_t;
+
+/**********************
+ * GLOBAL PROTOTYPES
+ **********************/
+
+/**
+ * Select the fastest kernels supported by the CPU (SSE2, AVX2 or NEON).
+ * Safe to call more than once. Until it is called the scalar kernels are used.
+ */
+void pixconv_init(void);
+
+/**
+ * Get the name of the instruction set the kernels were selected for
+ * @return "scalar", "sse2", "avx2" or "neon"
+ */
+const char * pixconv_get_isa(void);
+
+/* Raw row kernels. `dst` and `src` must not overlap, `px` is the pixel count. */
+void pixconv_rgb565_to_xrgb8888(uint32_t * dst, const uint16_t * src, uint32_t px);
+void pixconv_rgb565_to_rgb888(uint8_t * dst, const uint16_t * src, uint32_t px);
+void pixconv_rgb565_to_bgr888(uint8_t * dst, const uint16_t * src, uint32_t px);
+void pixconv_rgb565_to_rgb332(uint8_t * dst, const uint16_t * src, uint32_t px);
+void pixconv_rgb565_swap(uint16_t * dst, const uint16_t * src, uint32_t px);
+void pixconv_xrgb8888_to_rgb565(uint16_t * dst, const uint32_t * src, uint32_t px);
+void pixconv_xrgb8888_to_bgr565(uint16_t * dst, const uint32_t * src, uint32_t px);
+void pixconv_xrgb8888_to_rgb888(uint8_t * dst, const uint32_t * src, uint32_t px);
+void pixconv_xrgb8888_to_bgr888(uint8_t * dst, const uint32_t * src, uint32_t px);
+void pixconv_xrgb8888_to_rgb332(uint8_t * dst, const uint32_t * src, uint32_t px);
+void pixconv_xrgb8888_to_xbgr8888(uint32_t * dst, const uint32_t * src, uint32_t px); /*May run in place*/
+
+/* Convert a row of `lv_color_t` (any LV_COLOR_DEPTH, honouring LV_COLOR_16_SWAP) */
+void pixconv_lv_to_xrgb8888(uint32_t * dst, const lv_color_t * src, uint32_t px);
+void pixconv_lv_to_xbgr8888(uint32_t * dst, const lv_color_t * src, uint32_t px);
+void pixconv_lv_to_rgb565(uint16_t * dst, const lv_color_t * src, uint32_t px);
+void pixconv_lv_to_bgr565(uint16_t * dst, const lv_color_t * src, uint32_t px);
+void pixconv_lv_to_rgb888(uint8_t * dst, const lv_color_t * src, uint32_t px);
+void pixconv_lv_to_bgr888(uint8_t * dst, const lv_color_t * src, uint32_t px);
+void pixconv_lv_to_rgb332(uint8_t * dst, const lv_color_t * src, uint32_t px);
+
+/**
+ * Copy to write-combined or uncached memory (e.g. a mapped framebuffer) with
+ * non-temporal stores (SSE2 `movntdq`, AArch64 `stnp`) that bypass the cache.
+ * Falls back to `memcpy` for short copies and on other CPUs.
+ * Call `pixconv_stream_fence` before the result is shown.
+ * @param dst destination
+ * @param src source, must not overlap with `dst`
+ * @param size number of bytes
+ */
+void pixconv_copy_stream(void * dst, const void * src, size_t size);
+
+/**
+ * Make the data of `pixconv_copy_stream` globally visible (`sfence` / `dmb`)
+ */
+void pixconv_stream_fence(void);
+
+/**
+ * Fill a buffer with one pixel by doubling the filled part with `memcpy`
+ * @param buf the buffer
+ * @param pixel the pixel to repeat
+ * @param size bytes per pixel
+ * @param px number of pixels
+ */
+void pixconv_fill(void * buf, const void * pixel, size_t size, size_t px);
+
+/**
+ * Start decoding a run-length encoded 1 bpp image, see `pixconv_rle_t` for the format
+ * @param rle decoder state to initialize
+ * @param data the encoded image
+ * @param size size of `data` in bytes
+ * @param w width of the image
+ * @param h height of the image
+ */
+void pixconv_rle_init(pixconv_rle_t * rle, const uint8_t * data, size_t size, size_t w, size_t h);
+
+/**
+ * Get the next span of a run-length encoded image. Spans come in line order and never cross a line end.
+ * When the data ends within a line, the rest of that line is returned as background.
+ * @param rle the decoder state
+ * @param span store the span here
+ * @return false at the end of the image
+ */
+bool pixconv_rle_next(pixconv_rle_t * rle, pixconv_rle_span_t * span);
+
+/**********************
+ *      MACROS
+ **********************/
+
+#endif /*USE_FBDEV || USE_BSD_FBDEV || USE_DRM || USE_MONITOR || USE_GTK*/
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /*PIXCONV_H*/
@@ -0,0 +1,892 @@
+/**
+ * @file pixconv_test.c
+ * Correctness test of pixconv.c:
+ *  - the scalar kernels against the pixel format definitions
+ *  - every SIMD kernel the CPU can run against the scalar one
+ *  - the `pixconv_lv_to_*` rows against LVGL's `lv_color_to32/16/8`
+ *  - `pixconv_copy_stream` against `memcpy`
+ *  - `pixconv_fill` and the run-length decoder of the splash screens
+ * for all RGB565 inputs, every RGB888 color, odd lengths and misaligned rows.
+ *
+ * Built and run for several LV_COLOR_DEPTH / LV_COLOR_16_SWAP configurations
+ * by `make check` in this directory, compiles to nothing in the lv_drivers.mk build.
+ */
+
+/*********************
+ *      INCLUDES
+ *********************/
+#include "pixconv.h"
+#if defined(PIXCONV_TEST) && (USE_FBDEV || USE_BSD_FBDEV || USE_DRM || USE_MONITOR || USE_GTK)
+
+/*The kernels are static, test them from the inside*/
+#include "pixconv.c"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/*********************
+ *      DEFINES
+ *********************/
+/*Rows of 0..TAIL_MAX pixels cover every head and tail of the vector loops*/
+#define TAIL_MAX 67
+
+/*Element offsets tried for the source and destination rows*/
+#define OFFSET_MAX 8
+
+/*Pixels per call in the exhaustive runs*/
+#define CHUNK 65536
+
+/*Bytes around the destination checked for stray writes*/
+#define GUARD 64
+
+/*`pixconv_copy_stream` sizes swept with every alignment: the memcpy path, the head, 64 byte blocks and the tail*/
+#define COPY_SIZE_MAX (PIXCONV_STREAM_MIN + 4 * 64 + 16)
+
+/*Size of the run-length encoded test images*/
+#define RLE_W 37
+#define RLE_H 9
+
+/**********************
+ *      TYPEDEFS
+ **********************/
+typedef enum {
+    F_XRGB8888,
+    F_XBGR8888,
+    F_RGB565,
+    F_BGR565,
+    F_RGB565_SWAP, /*RGB565 with the bytes swapped*/
+    F_RGB888,
+    F_BGR888,
+    F_RGB332,
+} fmt_t;
+
+typedef struct {
+    uint8_t size;    /*Bytes per pixel*/
+    uint8_t bits[3]; /*Bits of red, green and blue*/
+} fmt_desc_t;
+
+typedef enum {
+    K_RGB565_TO_XRGB8888,
+    K_RGB565_TO_RGB888,
+    K_RGB565_TO_BGR888,
+    K_RGB565_TO_RGB332,
+    K_RGB565_SWAP,
+    K_XRGB8888_TO_RGB565,
+    K_XRGB8888_TO_BGR565,
+    K_XRGB8888_TO_RGB888,
+    K_XRGB8888_TO_BGR888,
+    K_XRGB8888_TO_RGB332,
+    K_XRGB8888_TO_XBGR8888,
+    K_COUNT
+} kernel_id_t;
+
+typedef struct {
+    const char * name;
+    fmt_t src_fmt;
+    fmt_t dst_fmt;
+} kernel_desc_t;
+
+typedef enum {
+    L_XRGB8888,
+    L_XBGR8888,
+    L_RGB565,
+    L_BGR565,
+    L_RGB888,
+    L_BGR888,
+    L_RGB332,
+    L_COUNT
+} lv_row_id_t;
+
+typedef struct {
+    const char * name;
+    fmt_t fmt;
+} lv_row_desc_t;
+
+/**********************
+ *  STATIC VARIABLES
+ **********************/
+static const fmt_desc_t fmt_desc[] = {
+    [F_XRGB8888]    = {4, {8, 8, 8}},
+    [F_XBGR8888]    = {4, {8, 8, 8}},
+    [F_RGB565]      = {2, {5, 6, 5}},
+    [F_BGR565]      = {2, {5, 6, 5}},
+    [F_RGB565_SWAP] = {2, {5, 6, 5}},
+    [F_RGB888]      = {3, {8, 8, 8}},
+    [F_BGR888]      = {3, {8, 8, 8}},
+    [F_RGB332]      = {1, {3, 3, 2}},
+};
+
+static const kernel_desc_t kernel_desc[K_COUNT] = {
+    [K_RGB565_TO_XRGB8888]   = {"rgb565_to_xrgb8888", F_RGB565, F_XRGB8888},
+    [K_RGB565_TO_RGB888]     = {"rgb565_to_rgb888", F_RGB565, F_RGB888},
+    [K_RGB565_TO_BGR888]     = {"rgb565_to_bgr888", F_RGB565, F_BGR888},
+    [K_RGB565_TO_RGB332]     = {"rgb565_to_rgb332", F_RGB565, F_RGB332},
+    [K_RGB565_SWAP]          = {"rgb565_swap", F_RGB565, F_RGB565_SWAP},
+    [K_XRGB8888_TO_RGB565]   = {"xrgb8888_to_rgb565", F_XRGB8888, F_RGB565},
+    [K_XRGB8888_TO_BGR565]   = {"xrgb8888_to_bgr565", F_XRGB8888, F_BGR565},
+    [K_XRGB8888_TO_RGB888]   = {"xrgb8888_to_rgb888", F_XRGB8888, F_RGB888},
+    [K_XRGB8888_TO_BGR888]   = {"xrgb8888_to_bgr888", F_XRGB8888, F_BGR888},
+    [K_XRGB8888_TO_RGB332]   = {"xrgb8888_to_rgb332", F_XRGB8888, F_RGB332},
+    [K_XRGB8888_TO_XBGR8888] = {"xrgb8888_to_xbgr8888", F_XRGB8888, F_XBGR8888},
+};
+
+static const lv_row_desc_t lv_row_desc[L_COUNT] = {
+    [L_XRGB8888] = {"lv_to_xrgb8888", F_XRGB8888},
+    [L_XBGR8888] = {"lv_to_xbgr8888", F_XBGR8888},
+    [L_RGB565]   = {"lv_to_rgb565", F_RGB565},
+    [L_BGR565]   = {"lv_to_bgr565", F_BGR565},
+    [L_RGB888]   = {"lv_to_rgb888", F_RGB888},
+    [L_BGR888]   = {"lv_to_bgr888", F_BGR888},
+    [L_RGB332]   = {"lv_to_rgb332", F_RGB332},
+};
+
+/*Row lengths around the LV_COLOR_16_SWAP chunks, on top of 0..TAIL_MAX*/
+static const uint32_t lv_chunk_px[] = {PIXCONV_CHUNK - 1, PIXCONV_CHUNK, PIXCONV_CHUNK + 1,
+                                       2 * PIXCONV_CHUNK + 3
+                                      };
+
+/*Rows are 64 byte aligned, the offsets are added on top*/
+static uint32_t src_buf[(CHUNK + OFFSET_MAX) + 16] __attribute__((aligned(64)));
+static uint32_t dst_buf[(CHUNK * 4 + OFFSET_MAX * 4 + 2 * GUARD) / 4 + 16] __attribute__((aligned(64)));
+static uint32_t ref_buf[(CHUNK * 4 + OFFSET_MAX * 4 + 2 * GUARD) / 4 + 16] __attribute__((aligned(64)));
+
+static uint32_t rnd = 0x12345678;
+
+/**********************
+ *   STATIC FUNCTIONS
+ **********************/
+
+static uint32_t rand_next(void)
+{
+    /*xorshift32, the same inputs on every run*/
+    rnd ^= rnd << 13;
+    rnd ^= rnd >> 17;
+    rnd ^= rnd << 5;
+    return rnd;
+}
+
+/*-----------------
+ * Pixel formats
+ *----------------*/
+
+/*Get the red, green and blue bits of the pixel at `p`. Formats are little-endian words, like the targets.*/
+static void fmt_decode(fmt_t fmt, const uint8_t * p, uint32_t ch[3])
+{
+    uint32_t v;
+
+    switch(fmt) {
+        case F_XRGB8888:
+        case F_XBGR8888:
+            v     = p[0] | (p[1] << 8) | ((uint32_t)p[2] << 16);
+            ch[0] = fmt == F_XRGB8888 ? (v >> 16) & 0xFF : v & 0xFF;
+            ch[1] = (v >> 8) & 0xFF;
+            ch[2] = fmt == F_XRGB8888 ? v & 0xFF : (v >> 16) & 0xFF;
+            break;
+        case F_RGB565:
+        case F_BGR565:
+        case F_RGB565_SWAP:
+            v     = fmt == F_RGB565_SWAP ? (p[0] << 8) | p[1] : p[0] | (p[1] << 8);
+            ch[0] = fmt == F_BGR565 ? v & 0x1F : v >> 11;
+            ch[1] = (v >> 5) & 0x3F;
+            ch[2] = fmt == F_BGR565 ? v >> 11 : v & 0x1F;
+            break;
+        case F_RGB888:
+            ch[0] = p[2];
+            ch[1] = p[1];
+            ch[2] = p[0];
+            break;
+        case F_BGR888:
+            ch[0] = p[0];
+            ch[1] = p[1];
+            ch[2] = p[2];
+            break;
+        default:
+            ch[0] = p[0] >> 5;
+            ch[1] = (p[0] >> 2) & 0x7;
+            ch[2] = p[0] & 0x3;
+            break;
+    }
+}
+
+/**
+ * Check a converted channel. Narrowing keeps the top bits. Widening keeps
+ * the bits on top and must be within 1 of the exact value, so that e.g.
+ * 0x1F becomes 0xFF.
+ */
+static bool chan_ok(uint32_t in, uint32_t in_bits, uint32_t out, uint32_t out_bits)
+{
+    uint32_t in_max  = (1u << in_bits) - 1;
+    uint32_t out_max = (1u << out_bits) - 1;
+    int32_t diff;
+
+    if(out_bits <= in_bits) return out == in >> (in_bits - out_bits);
+    if(out >> (out_bits - in_bits) != in) return false;
+
+    diff = (int32_t)(out * in_max) - (int32_t)(in * out_max);
+    return diff >= -(int32_t)in_max && diff <= (int32_t)in_max;
+}
+
+/*-----------------
+ * Row kernels
+ *----------------*/
+
+static void kernel_run(const pixconv_kernels_t * k, kernel_id_t id, void * dst, const void * src, uint32_t px)
+{
+    switch(id) {
+        case K_RGB565_TO_XRGB8888:
+            k->rgb565_to_xrgb8888(dst, src, px);
+            break;
+        case K_RGB565_TO_RGB888:
+            k->rgb565_to_rgb888(dst, src, px);
+            break;
+        case K_RGB565_TO_BGR888:
+            k->rgb565_to_bgr888(dst, src, px);
+            break;
+        case K_RGB565_TO_RGB332:
+            pixconv_rgb565_to_rgb332(dst, src, px);
+            break;
+        case K_RGB565_SWAP:
+            k->rgb565_swap(dst, src, px);
+            break;
+        case K_XRGB8888_TO_RGB565:
+            k->xrgb8888_to_rgb565(dst, src, px);
+            break;
+        case K_XRGB8888_TO_BGR565:
+            k->xrgb8888_to_bgr565(dst, src, px);
+            break;
+        case K_XRGB8888_TO_RGB888:
+            k->xrgb8888_to_rgb888(dst, src, px);
+            break;
+        case K_XRGB8888_TO_BGR888:
+            k->xrgb8888_to_bgr888(dst, src, px);
+            break;
+        case K_XRGB8888_TO_RGB332:
+            pixconv_xrgb8888_to_rgb332(dst, src, px);
+            break;
+        default:
+            k->xrgb8888_to_xbgr8888(dst, src, px);
+            break;
+    }
+}
+
+/*Whether the kernel of `id` in `k` is another function than in the scalar table `ref`*/
+static bool kernel_differs(const pixconv_kernels_t * k, const pixconv_kernels_t * ref, kernel_id_t id)
+{
+    switch(id) {
+        case K_RGB565_TO_XRGB8888:
+            return k->rgb565_to_xrgb8888 != ref->rgb565_to_xrgb8888;
+        case K_RGB565_TO_RGB888:
+            return k->rgb565_to_rgb888 != ref->rgb565_to_rgb888;
+        case K_RGB565_TO_BGR888:
+            return k->rgb565_to_bgr888 != ref->rgb565_to_bgr888;
+        case K_RGB565_SWAP:
+            return k->rgb565_swap != ref->rgb565_swap;
+        case K_XRGB8888_TO_RGB565:
+            return k->xrgb8888_to_rgb565 != ref->xrgb8888_to_rgb565;
+        case K_XRGB8888_TO_BGR565:
+            return k->xrgb8888_to_bgr565 != ref->xrgb8888_to_bgr565;
+        case K_XRGB8888_TO_RGB888:
+            return k->xrgb8888_to_rgb888 != ref->xrgb8888_to_rgb888;
+        case K_XRGB8888_TO_BGR888:
+            return k->xrgb8888_to_bgr888 != ref->xrgb8888_to_bgr888;
+        case K_XRGB8888_TO_XBGR8888:
+            return k->xrgb8888_to_xbgr8888 != ref->xrgb8888_to_xbgr8888;
+        default:
+            /*Scalar only*/
+            return false;
+    }
+}
+
+/*Fill the source with every RGB565 value, or with chunk `base` of the RGB888 colors and random X bits*/
+static void kernel_fill(kernel_id_t id, uint32_t base)
+{
+    uint32_t i;
+
+    if(kernel_desc[id].src_fmt == F_RGB565) {
+        for(i = 0; i < CHUNK; i++) ((uint16_t *)src_buf)[i] = (uint16_t)i;
+    } else {
+        for(i = 0; i < CHUNK; i++) src_buf[i] = (rand_next() & 0xFF000000) | (base + i);
+    }
+}
+
+/*Check the scalar kernel of `id` in `ref` against the format definitions*/
+static bool test_reference(const pixconv_kernels_t * ref, kernel_id_t id)
+{
+    const kernel_desc_t * d = &kernel_desc[id];
+    const fmt_desc_t * sf   = &fmt_desc[d->src_fmt];
+    const fmt_desc_t * df   = &fmt_desc[d->dst_fmt];
+    uint32_t end            = sf->size == 2 ? CHUNK : 0x1000000;
+    uint32_t base, i, c, in[3], out[3];
+    uint32_t x_exp, x_out;
+
+    for(base = 0; base < end; base += CHUNK) {
+        kernel_fill(id, base);
+        kernel_run(ref, id, dst_buf, src_buf, CHUNK);
+
+        for(i = 0; i < CHUNK; i++) {
+            const uint8_t * s = (const uint8_t *)src_buf + i * sf->size;
+            const uint8_t * p = (const uint8_t *)dst_buf + i * df->size;
+            bool ok           = true;
+
+            fmt_decode(d->src_fmt, s, in);
+            fmt_decode(d->dst_fmt, p, out);
+            for(c = 0; c < 3; c++) ok = ok && chan_ok(in[c], sf->bits[c], out[c], df->bits[c]);
+
+            /*X is kept, or opaque when there was none*/
+            if(df->size == 4) {
+                x_exp = sf->size == 4 ? s[3] : 0xFF;
+                x_out = p[3];
+                ok    = ok && x_out == x_exp;
+            }
+
+            if(!ok) {
+                printf("  %s: input 0x%X gives r %u g %u b %u\n", d->name,
+                       sf->size == 2 ? ((const uint16_t *)src_buf)[i] : src_buf[i], out[0], out[1], out[2]);
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Run `px` pixels from `src_off` elements into the source through the kernel
+ * and the scalar reference, `dst_off` bytes into guarded destinations, and
+ * compare the destinations including the guard bytes.
+ */
+static bool compare_run(const pixconv_kernels_t * k, const pixconv_kernels_t * ref, kernel_id_t id,
+                        uint32_t src_off, uint32_t dst_off, uint32_t px, bool in_place)
+{
+    const kernel_desc_t * d = &kernel_desc[id];
+    uint32_t src_size       = fmt_desc[d->src_fmt].size;
+    uint32_t dst_size       = fmt_desc[d->dst_fmt].size;
+    const uint8_t * src     = (const uint8_t *)src_buf + src_off * src_size;
+    uint8_t * dst           = (uint8_t *)dst_buf + GUARD + dst_off;
+    uint8_t * exp           = (uint8_t *)ref_buf + GUARD + dst_off;
+    size_t len              = (size_t)GUARD * 2 + dst_off + (size_t)px * dst_size;
+    size_t i;
+
+    memset(dst_buf, 0xA5, len);
+    memset(ref_buf, 0xA5, len);
+
+    kernel_run(ref, id, exp, src, px);
+
+    if(in_place) {
+        memcpy(dst, src, (size_t)px * src_size);
+        kernel_run(k, id, dst, dst, px);
+    } else {
+        kernel_run(k, id, dst, src, px);
+    }
+
+    if(memcmp(dst_buf, ref_buf, len) == 0) return true;
+
+    i = 0;
+    while(((uint8_t *)dst_buf)[i] == ((uint8_t *)ref_buf)[i]) i++;
+    printf("  %s%s: %u px, src offset %u, dst offset %u: byte %d is 0x%02X, expected 0x%02X\n", d->name,
+           in_place ? " (in place)" : "", px, src_off, dst_off, (int)i - GUARD - (int)dst_off,
+           ((uint8_t *)dst_buf)[i], ((uint8_t *)ref_buf)[i]);
+    return false;
+}
+
+/*Compare the kernel of `id` in `k` with the scalar one*/
+static bool test_kernel(const pixconv_kernels_t * k, const pixconv_kernels_t * ref, kernel_id_t id)
+{
+    const kernel_desc_t * d = &kernel_desc[id];
+    uint32_t dst_size       = fmt_desc[d->dst_fmt].size;
+    uint32_t dst_align      = dst_size == 3 ? 1 : dst_size;
+    uint32_t end            = fmt_desc[d->src_fmt].size == 2 ? CHUNK : 0x1000000;
+    uint32_t i, base, px, src_off, dst_off;
+
+    /*Every RGB565 value, or every RGB888 color with varying X bits*/
+    for(base = 0; base < end; base += CHUNK) {
+        kernel_fill(id, base);
+        if(!compare_run(k, ref, id, 0, 0, CHUNK, false)) return false;
+    }
+
+    /*Heads and tails with misaligned source and destination rows*/
+    for(i = 0; i < TAIL_MAX + OFFSET_MAX; i++) src_buf[i] = rand_next();
+
+    for(px = 0; px <= TAIL_MAX; px++) {
+        for(src_off = 0; src_off < OFFSET_MAX; src_off++) {
+            for(dst_off = 0; dst_off < OFFSET_MAX * dst_size; dst_off += dst_align) {
+                if(!compare_run(k, ref, id, src_off, dst_off, px, false)) return false;
+            }
+        }
+    }
+
+    /*xrgb8888_to_xbgr8888 may be run in place*/
+    if(id == K_XRGB8888_TO_XBGR8888) {
+        for(px = 0; px <= TAIL_MAX; px++) {
+            for(dst_off = 0; dst_off < OFFSET_MAX * 4; dst_off += 4) {
+                if(!compare_run(k, ref, id, 0, dst_off, px, true)) return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+static uint32_t test_isa(const pixconv_kernels_t * k, const pixconv_kernels_t * ref)
+{
+    uint32_t fails = 0, tested = 0;
+    int id;
+
+    for(id = 0; id < K_COUNT; id++) {
+        if(!kernel_differs(k, ref, id)) continue;
+        tested++;
+        if(!test_kernel(k, ref, id)) fails++;
+    }
+
+    printf("%s: %u kernels tested against scalar, %u failed\n", k->isa, tested, fails);
+    return fails;
+}
+
+/*-----------------
+ * lv_color_t rows
+ *----------------*/
+
+static void lv_row_run(lv_row_id_t id, void * dst, const lv_color_t * src, uint32_t px)
+{
+    switch(id) {
+        case L_XRGB8888:
+            pixconv_lv_to_xrgb8888(dst, src, px);
+            break;
+        case L_XBGR8888:
+            pixconv_lv_to_xbgr8888(dst, src, px);
+            break;
+        case L_RGB565:
+            pixconv_lv_to_rgb565(dst, src, px);
+            break;
+        case L_BGR565:
+            pixconv_lv_to_bgr565(dst, src, px);
+            break;
+        case L_RGB888:
+            pixconv_lv_to_rgb888(dst, src, px);
+            break;
+        case L_BGR888:
+            pixconv_lv_to_bgr888(dst, src, px);
+            break;
+        default:
+            pixconv_lv_to_rgb332(dst, src, px);
+            break;
+    }
+}
+
+/*Get the channels of an LVGL color and their bits*/
+static void lv_channels(lv_color_t c, uint32_t ch[3], uint32_t bits[3])
+{
+#if LV_COLOR_DEPTH == 1
+    ch[0] = ch[1] = ch[2] = c.full;
+    bits[0] = bits[1] = bits[2] = 1;
+#elif LV_COLOR_DEPTH == 8
+    ch[0]   = c.ch.red;
+    ch[1]   = c.ch.green;
+    ch[2]   = c.ch.blue;
+    bits[0] = 3;
+    bits[1] = 3;
+    bits[2] = 2;
+#elif LV_COLOR_DEPTH == 16
+    ch[0] = c.ch.red;
+#if LV_COLOR_16_SWAP
+    ch[1] = (c.ch.green_h << 3) | c.ch.green_l;
+#else
+    ch[1] = c.ch.green;
+#endif
+    ch[2]   = c.ch.blue;
+    bits[0] = 5;
+    bits[1] = 6;
+    bits[2] = 5;
+#else
+    ch[0]   = c.ch.red;
+    ch[1]   = c.ch.green;
+    ch[2]   = c.ch.blue;
+    bits[0] = bits[1] = bits[2] = 8;
+#endif
+}
+
+/**
+ * Check a converted LVGL color. Narrowing keeps the top bits. Widening must
+ * give what `lv_color_to32/16/8` give; LVGL rounds RGB565 to 8 bit where
+ * pixconv replicates the bits, so 1 off is fine there.
+ */
+static bool lv_pixel_ok(lv_color_t c, fmt_t fmt, const uint8_t * p)
+{
+    const fmt_desc_t * f = &fmt_desc[fmt];
+    uint32_t in[3], bits[3], out[3], wide[3];
+    uint32_t i, v, tol;
+
+    lv_channels(c, in, bits);
+    fmt_decode(fmt, p, out);
+
+    if(f->size >= 3) {
+        v       = lv_color_to32(c);
+        wide[0] = (v >> 16) & 0xFF;
+        wide[1] = (v >> 8) & 0xFF;
+        wide[2] = v & 0xFF;
+        tol     = LV_COLOR_DEPTH == 16;
+    } else if(f->size == 2) {
+        /*Not a byte swapped one below 16 bit depth*/
+        v       = lv_color_to16(c);
+        wide[0] = v >> 11;
+        wide[1] = (v >> 5) & 0x3F;
+        wide[2] = v & 0x1F;
+        tol     = 0;
+    } else {
+        v       = lv_color_to8(c);
+        wide[0] = v >> 5;
+        wide[1] = (v >> 2) & 0x7;
+        wide[2] = v & 0x3;
+        tol     = 0;
+    }
+
+    for(i = 0; i < 3; i++) {
+        if(f->bits[i] <= bits[i]) {
+            if(out[i] != in[i] >> (bits[i] - f->bits[i])) return false;
+        } else {
+            if(out[i] + tol < wide[i] || out[i] > wide[i] + tol) return false;
+        }
+    }
+
+    return true;
+}
+
+/*Get an LVGL color from the `i`th input value*/
+static lv_color_t lv_input(uint32_t i)
+{
+    lv_color_t c;
+#if LV_COLOR_DEPTH == 1
+    c.full = i & 1;
+#elif LV_COLOR_DEPTH == 32
+    c.full = (rand_next() & 0xFF000000) | (i & 0xFFFFFF);
+#else
+    c.full = i;
+#endif
+    return c;
+}
+
+/*Convert `px` colors from `src_off` into a guarded destination `dst_off` bytes in and check them*/
+static bool lv_compare_run(lv_row_id_t id, uint32_t src_off, uint32_t dst_off, uint32_t px)
+{
+    const lv_row_desc_t * d = &lv_row_desc[id];
+    uint32_t size           = fmt_desc[d->fmt].size;
+    const lv_color_t * src  = (const lv_color_t *)src_buf + src_off;
+    uint8_t * all           = (uint8_t *)dst_buf;
+    uint8_t * dst           = all + GUARD + dst_off;
+    size_t len              = (size_t)GUARD * 2 + dst_off + (size_t)px * size;
+    size_t i;
+
+    memset(dst_buf, 0xA5, len);
+    lv_row_run(id, dst, src, px);
+
+    for(i = 0; i < px; i++) {
+        if(!lv_pixel_ok(src[i], d->fmt, dst + i * size)) {
+            printf("  %s: %u px, src offset %u, dst offset %u: pixel %u of 0x%X is wrong\n", d->name, px,
+                   src_off, dst_off, (unsigned)i, (unsigned)src[i].full);
+            return false;
+        }
+    }
+
+    for(i = 0; i < len; i++) {
+        if(all + i == dst) i += (size_t)px * size;
+        if(i < len && all[i] != 0xA5) {
+            printf("  %s: %u px, src offset %u, dst offset %u: stray write at byte %d\n", d->name, px, src_off,
+                   dst_off, (int)i - GUARD - (int)dst_off);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool test_lv_row(lv_row_id_t id)
+{
+    uint32_t size  = fmt_desc[lv_row_desc[id].fmt].size;
+    uint32_t align = size == 3 ? 1 : size;
+    uint32_t inputs, base, i, px, src_off, dst_off;
+
+    /*Every color, or some million of them with 32 bit depth*/
+    inputs = LV_COLOR_DEPTH == 32 ? 16 * CHUNK : 1u << LV_COLOR_DEPTH;
+    for(base = 0; base < inputs; base += CHUNK) {
+        uint32_t n = LV_MATH_MIN(inputs - base, CHUNK);
+        for(i = 0; i < n; i++) ((lv_color_t *)src_buf)[i] = lv_input(LV_COLOR_DEPTH == 32 ? rand_next() : base + i);
+        if(!lv_compare_run(id, 0, 0, n)) return false;
+    }
+
+    /*Heads, tails and the LV_COLOR_16_SWAP chunks with misaligned rows*/
+    for(i = 0; i < 3 * PIXCONV_CHUNK + OFFSET_MAX; i++) ((lv_color_t *)src_buf)[i] = lv_input(rand_next());
+
+    for(px = 0; px <= TAIL_MAX + sizeof(lv_chunk_px) / sizeof(lv_chunk_px[0]); px++) {
+        uint32_t n = px <= TAIL_MAX ? px : lv_chunk_px[px - TAIL_MAX - 1];
+        for(src_off = 0; src_off < OFFSET_MAX; src_off++) {
+            for(dst_off = 0; dst_off < OFFSET_MAX * size; dst_off += align) {
+                if(!lv_compare_run(id, src_off, dst_off, n)) return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+/*Check the `pixconv_lv_to_*` rows with the current kernels*/
+static uint32_t test_lv(void)
+{
+    uint32_t fails = 0;
+    int id;
+
+    for(id = 0; id < L_COUNT; id++) {
+        if(!test_lv_row(id)) fails++;
+    }
+
+    printf("%s: %d lv_color_t rows tested against LVGL (LV_COLOR_DEPTH %d, LV_COLOR_16_SWAP %d), %u failed\n",
+           kern.isa, L_COUNT, LV_COLOR_DEPTH, LV_COLOR_16_SWAP, fails);
+    return fails;
+}
+
+/*-----------------
+ * Streaming copy
+ *----------------*/
+
+static bool copy_stream_run(uint32_t src_off, uint32_t dst_off, uint32_t size)
+{
+    const uint8_t * src = (const uint8_t *)src_buf + src_off;
+    uint8_t * all       = (uint8_t *)dst_buf;
+    uint8_t * dst       = all + GUARD + dst_off;
+    size_t len          = (size_t)GUARD * 2 + dst_off + size;
+    size_t i;
+
+    memset(dst_buf, 0xA5, len);
+    pixconv_copy_stream(dst, src, size);
+    pixconv_stream_fence();
+
+    for(i = 0; i < len; i++) {
+        uint8_t exp = all + i >= dst && all + i < dst + size ? src[all + i - dst] : 0xA5;
+        if(all[i] != exp) {
+            printf("  copy_stream: %u bytes, src offset %u, dst offset %u: byte %d is 0x%02X, expected 0x%02X\n",
+                   size, src_off, dst_off, (int)i - GUARD - (int)dst_off, all[i], exp);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static uint32_t test_copy_stream(void)
+{
+    static const uint32_t large[] = {4096, 4096 + 37, 65536 + 15};
+    uint32_t size, src_off, dst_off, i;
+
+    for(i = 0; i < CHUNK; i++) src_buf[i] = rand_next();
+
+    /*Every relative alignment of the 16 byte head*/
+    for(size = 0; size <= COPY_SIZE_MAX; size++) {
+        for(src_off = 0; src_off < 16; src_off++) {
+            for(dst_off = 0; dst_off < 16; dst_off++) {
+                if(!copy_stream_run(src_off, dst_off, size)) goto fail;
+            }
+        }
+    }
+
+    for(i = 0; i < sizeof(large) / sizeof(large[0]); i++) {
+        for(dst_off = 0; dst_off < 16; dst_off += 5) {
+            if(!copy_stream_run(3, dst_off, large[i])) goto fail;
+        }
+    }
+
+    printf("copy_stream: passed\n");
+    return 0;
+
+fail:
+    printf("copy_stream: failed\n");
+    return 1;
+}
+
+/*-----------------
+ * Splash screens
+ *----------------*/
+
+static uint32_t test_fill(void)
+{
+    uint8_t * all = (uint8_t *)dst_buf;
+    uint8_t pixel[4];
+    size_t size, px, i;
+
+    for(size = 1; size <= sizeof(pixel); size++) {
+        for(px = 0; px <= TAIL_MAX; px++) {
+            for(i = 0; i < size; i++) pixel[i] = rand_next();
+            memset(all, 0xA5, GUARD * 2 + px * size);
+            pixconv_fill(all + GUARD, pixel, size, px);
+
+            for(i = 0; i < GUARD * 2 + px * size; i++) {
+                bool in     = i >= GUARD && i < GUARD + px * size;
+                uint8_t exp = in ? pixel[(i - GUARD) % size] : 0xA5;
+                if(all[i] != exp) {
+                    printf("  fill: %u bytes per pixel, %u pixels: byte %d is 0x%02X, expected 0x%02X\n",
+                           (unsigned)size, (unsigned)px, (int)i - GUARD, all[i], exp);
+                    printf("fill: failed\n");
+                    return 1;
+                }
+            }
+        }
+    }
+
+    printf("fill: passed\n");
+    return 0;
+}
+
+/*Append an LEB128 run length, `extra` adds redundant zero groups*/
+static size_t rle_put(uint8_t * data, size_t pos, size_t run, uint32_t extra)
+{
+    do {
+        uint8_t b = run & 0x7F;
+        run >>= 7;
+        data[pos++] = b | (run || extra ? 0x80 : 0);
+    } while(run);
+    for(; extra > 0; extra--) data[pos++] = extra > 1 ? 0x80 : 0x00;
+    return pos;
+}
+
+/**
+ * Encode a random image with long and empty runs, truncate it and check that the spans
+ * paint every pixel of the started lines exactly once, in order and in the right color
+ */
+static bool rle_run(uint32_t trunc)
+{
+    static uint8_t img[RLE_H * RLE_W];
+    static uint8_t data[RLE_H * RLE_W * 4];
+    static uint8_t painted[RLE_H * RLE_W];
+    pixconv_rle_t rle;
+    pixconv_rle_span_t span;
+    size_t size = 0, covered = 0, end, i = 0, next = 0;
+    bool fg = false;
+
+    while(i < RLE_H * RLE_W) {
+        uint32_t r = rand_next();
+        size_t run = r & 0x10 ? r % (RLE_W * 3) : r % 4;
+        if(run > RLE_H * RLE_W - i) run = RLE_H * RLE_W - i;
+        size = rle_put(data, size, run, (r >> 8) % 8 == 0 ? 1 + (r >> 16) % 2 : 0);
+        for(; run > 0; run--) img[i++] = fg;
+        fg = !fg;
+    }
+
+    /*Cut after the last whole run before `trunc` bytes*/
+    if(trunc < size) {
+        size = trunc;
+        while(size > 0 && (data[size - 1] & 0x80)) size--;
+    }
+    for(i = 0; i < size;) {
+        uint32_t shift = 0;
+        do {
+            covered += (size_t)(data[i] & 0x7F) << shift;
+            shift += 7;
+        } while(data[i++] & 0x80);
+    }
+
+    /*Missing pixels of the last started line are background*/
+    end = (covered + RLE_W - 1) / RLE_W * RLE_W;
+    for(i = covered; i < end; i++) img[i] = false;
+
+    memset(painted, 0, sizeof(painted));
+    pixconv_rle_init(&rle, data, size, RLE_W, RLE_H);
+    while(pixconv_rle_next(&rle, &span)) {
+        if(span.len == 0 || span.x + span.len > RLE_W || span.y * RLE_W + span.x != next) {
+            printf("  rle: %u of %u bytes: unexpected span x %u, y %u, len %u\n", (unsigned)size, trunc,
+                   (unsigned)span.x, (unsigned)span.y, (unsigned)span.len);
+            return false;
+        }
+        for(i = next; i < next + span.len; i++) {
+            if(img[i] != span.fg) {
+                printf("  rle: %u of %u bytes: pixel %u, %u is %s\n", (unsigned)size, trunc, (unsigned)(i % RLE_W),
+                       (unsigned)(i / RLE_W), span.fg ? "foreground" : "background");
+                return false;
+            }
+        }
+        next += span.len;
+    }
+    if(next != end) {
+        printf("  rle: %u of %u bytes: %u pixels decoded, expected %u\n", (unsigned)size, trunc, (unsigned)next,
+               (unsigned)end);
+        return false;
+    }
+
+    return true;
+}
+
+static uint32_t test_rle(void)
+{
+    uint32_t trunc, i;
+
+    for(i = 0; i < 16; i++) {
+        for(trunc = 0; trunc < 64; trunc++) {
+            if(!rle_run(trunc)) goto fail;
+        }
+        if(!rle_run(UINT32_MAX)) goto fail;
+    }
+
+    printf("rle: passed\n");
+    return 0;
+
+fail:
+    printf("rle: failed\n");
+    return 1;
+}
+
+/**********************
+ *   GLOBAL FUNCTIONS
+ **********************/
+
+int main(void)
+{
+    /*`kern` holds the scalar kernels until pixconv_init()*/
+    const pixconv_kernels_t ref = kern;
+    pixconv_kernels_t isa[3]; /*The tables pixconv_init() can select on this CPU*/
+    uint32_t isa_cnt = 0, fails = 0, tested = 0, i;
+    int id;
+
+    for(id = 0; id < K_COUNT; id++) {
+        tested++;
+        if(!test_reference(&ref, id)) fails++;
+    }
+    printf("scalar: %u kernels tested against the formats, %u failed\n", tested, fails);
+
+#if PIXCONV_SSE2
+    isa[isa_cnt] = ref;
+    pixconv_kernels_sse2(&isa[isa_cnt]);
+    isa_cnt++;
+#endif
+
+#if PIXCONV_AVX2
+    /*On top of the SSE2 kernels*/
+    isa[isa_cnt] = isa[isa_cnt - 1];
+    if(pixconv_kernels_avx2(&isa[isa_cnt])) isa_cnt++;
+    else printf("avx2: not supported by this CPU, skipped\n");
+#endif
+
+#if PIXCONV_NEON
+    isa[isa_cnt] = ref;
+    pixconv_kernels_neon(&isa[isa_cnt]);
+    isa_cnt++;
+#endif
+
+    for(i = 0; i < isa_cnt; i++) fails += test_isa(&isa[i], &ref);
+
+    /*The lv_color_t rows with each table*/
+    fails += test_lv();
+    for(i = 0; i < isa_cnt; i++) {
+        kern = isa[i];
+        fails += test_lv();
+    }
+    kern = ref;
+
+    fails += test_copy_stream();
+    fails += test_fill();
+    fails += test_rle();
+
+    pixconv_init();
+    printf("pixconv_init() selects %s\n", pixconv_get_isa());
+
+    return fails ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+#endif /*PIXCONV_TEST*/
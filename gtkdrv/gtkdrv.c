@@ -17,6 +17,7 @@
 #include <pthread.h>
 #include <time.h>
 #include <sys/time.h>
+#include "../display/pixconv.h"
 
 /*********************
  *      DEFINES
@@ -74,6 +75,7 @@ void gtkdrv_init(void)
 {
     // Init GTK
     gtk_init(NULL, NULL);
+    pixconv_init();
 
     /* Or just set up the widgets in code */
     window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
@@ -152,18 +154,12 @@ void gtkdrv_flush_cb(lv_disp_drv_t * disp_drv, const lv_area_t * area, lv_color_
     }
 
     int32_t y;
-    int32_t x;
-    int32_t p;
+    int32_t w = lv_area_get_width(area);
+    int32_t copy_w = area->x2 < disp_drv->hor_res ? w : disp_drv->hor_res - area->x1;
     for(y = area->y1; y <= area->y2 && y < disp_drv->ver_res; y++) {
-        p = (y * disp_drv->hor_res + area->x1) * 3;
-        for(x = area->x1; x <= area->x2 && x < disp_drv->hor_res; x++) {
-            fb[p] = color_p->ch.red;
-            fb[p + 1] = color_p->ch.green;
-            fb[p + 2] = color_p->ch.blue;
-
-            p += 3;
-            color_p ++;
-        }
+        /*The pixbuf is packed R, G, B bytes*/
+        pixconv_lv_to_bgr888(&fb[(y * disp_drv->hor_res + area->x1) * 3], color_p, copy_w);
+        color_p += w;
     }
 
     /*IMPORTANT! It must be called to tell the system the flush is ready*/
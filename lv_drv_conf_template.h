@@ -259,6 +259,23 @@
 
 #if USE_FBDEV
 #  define FBDEV_PATH          "/dev/fb0"
+
+/* Render into a hidden page (yres_virtual = 2 * yres) and pan to it after vsync.
+ * A cached copy of the page (line_length * yres bytes) keeps the pages in sync.
+ * Falls back to drawing into the visible page if the driver cannot pan. */
+#  define FBDEV_DOUBLE_BUFFER 0
+
+/* Let LVGL render straight into the two mapped pages (no draw buffer, flush only pans).
+ * Needs panning, a matching color depth and line_length == xres * bytes per pixel,
+ * otherwise a normal draw buffer is used. */
+#  define FBDEV_DIRECT_RENDER 0
+
+/* Colormap of 8 bpp (pseudocolor) framebuffers:
+ * 0: assume RGB332, 1: install an RGB332 colormap, 2: use the device's colormap via a look-up table */
+#  define FBDEV_PALETTE       0
+
+/* 1: Try to switch the framebuffer to LV_COLOR_DEPTH on init (restored on exit) to avoid conversion */
+#  define FBDEV_MATCH_DEPTH   0
 #endif
 
 /*-----------------------------------------
@@ -282,6 +299,13 @@
 #if USE_DRM
 #  define DRM_CARD          "/dev/dri/card0"
 #  define DRM_CONNECTOR_ID  -1	/* -1 for the first connected one */
+#  define DRM_BUFFER_COUNT  2	/* 2..4, 3 lets LVGL draw on while a late frame waits for vblank */
+#  define DRM_RENDER_SCALE_NUM 1	/* render at NUM/DEN of the mode size (e.g. 1/2 or 2/3), */
+#  define DRM_RENDER_SCALE_DEN 1	/* the plane scales up, native size if it can't */
+#  define DRM_ROTATION DRM_MODE_ROTATE_0	/* e.g. DRM_MODE_ROTATE_90 for a panel mounted in portrait, */
+						/* | DRM_MODE_REFLECT_X/Y, in software if the plane can't */
+#  define DRM_STATS_LOG_PERIOD 0	/* print frame pacing statistics every N seconds, 0: off */
+#  define DRM_RENDER_MARGIN_US 1000	/* drm_render_delay_us() slack to get the frame committed before vblank */
 #endif
 
 /*********************